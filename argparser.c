@@ -1,10 +1,37 @@
 #include <stdlib.h>
+#include <string.h>
 #include <argp.h>
 
 #include "argparser.h"
+#include "tileset.h"
 
 #define BINARY 1
 #define BASENAME 2
+#define MANIFEST 3
+#define SHARED_TILESET 4
+#define TILEMAP 5
+#define TILE_OFFSET 6
+#define PRIORITY 7
+#define DIRECT_COLOR 8
+#define MAX_TILES 9
+#define SPRITE 10
+#define OBJ_SIZE 11
+#define FRAME 12
+#define MODE7 13
+#define TRACE 14
+#define SHARED_PALETTE 15
+#define REGION 16
+#define EMIT 17
+#define OPTIMIZE_PALETTE 18
+#define GRADIENT 19
+#define PACKED 20
+#define SUPERFX 21
+#define BITMAP 22
+#define PATCH_ROM 23
+#define PATCH_PROTECT 24
+#define PATCH_CHECKSUM 25
+#define DEDUP 26
+#define SPLIT_LAYERS 27
 
 /* Version and bugs address */
 const char *argp_program_version = "png2snes beta";
@@ -14,7 +41,7 @@ const char *argp_program_bug_address = "<tommy.savaria@protonmail.ch>";
 static char doc[] = "png2snes -- Create SNES Graphics from PNG files";
 
 /* A description of the arguments we accept. */
-static char args_doc[] = "INPUT_FILE";
+static char args_doc[] = "INPUT_FILE\n--shared-tileset INPUT_FILE...\n--shared-palette INPUT_FILE...\n--manifest=FILE";
 
 /* The options we understand. */
 static struct argp_option options[] = {
@@ -24,6 +51,31 @@ static struct argp_option options[] = {
   {"bitplanes", 'b', "PLANES", 0, "Number of bitplanes per tile (2,4 or 8)"},
   {"tilesize", 't', "SIZE", 0, "Size of tiles (8x8 or 16x16)"},
   {"binary", BINARY, 0, 0, "Output to binary format"},
+  {"shared-tileset", SHARED_TILESET, 0, 0, "Deduplicate the tiles of every input into one tileset"},
+  {"shared-palette", SHARED_PALETTE, 0, 0, "Pack the palettes of every input into one CGRAM and remap their pixels"},
+  {"tilemap", TILEMAP, "SIZE", OPTION_ARG_OPTIONAL, "Output a BG map (32x32, 64x32, 32x64 or 64x64, defaults to the smallest holding the image)"},
+  {"tile-offset", TILE_OFFSET, "TILE", 0, "Character number of the first tile in the BG map"},
+  {"priority", PRIORITY, 0, 0, "Set the priority bit of every BG map entry"},
+  {"optimize-palette", OPTIMIZE_PALETTE, 0, 0, "Merge identical colors, drop unused ones and use the fewest bitplanes that fit"},
+  {"gradient", GRADIENT, "WRITES", 0, "Fit the colors of each scanline in one sub-palette, rewriting at most WRITES colors per line with HDMA tables"},
+  {"packed", PACKED, 0, 0, "Store 2bpp tiles as 1bpp and 4bpp tiles as 3bpp, without their top bitplane"},
+  {"direct-color", DIRECT_COLOR, 0, 0, "Output 8bpp direct color tiles, without a palette"},
+  {"dedup", DEDUP, "flip", OPTION_ARG_OPTIONAL, "Store tiles differing only by their sub-palette (or their flip with =flip) once (implies --tilemap)"},
+  {"split-layers", SPLIT_LAYERS, 0, 0, "Split tiles using more than one sub-palette over a front and a back layer of 4bpp tiles (implies --tilemap)"},
+  {"max-tiles", MAX_TILES, "COUNT", 0, "Merge similar tiles until at most COUNT remain (implies --tilemap)"},
+  {"sprite", SPRITE, 0, 0, "Slice the image into OBJs, skipping empty tiles, and output a metasprite table"},
+  {"obj-size", OBJ_SIZE, "SMALL,LARGE", 0, "OBJ sizes available to sprites (8,16 8,32 8,64 16,32 16,64 or 32,64, defaults to 8,16)"},
+  {"frame", FRAME, "WIDTHxHEIGHT", 0, "Size of each frame of a sprite sheet (defaults to the whole image)"},
+  {"region", REGION, "X,Y,W,H", 0, "Only convert this part of the image, in pixels aligned to tiles. Repeat to convert several parts in one pass"},
+  {"emit", EMIT, "SPEC", 0, "Also output a variant of the tiles, as a list like bpp=4,tile=16,out=BASENAME. Repeat to output several variants from one decode"},
+  {"superfx", SUPERFX, "HEIGHT", 0, "Order characters in columns for a Super FX screen 128, 160 or 192 pixels high"},
+  {"bitmap", BITMAP, 0, 0, "Output a linear bitmap with packed pixels, as read by SA-1 character conversion"},
+  {"mode7", MODE7, 0, 0, "Output the Mode 7 map and characters interleaved, as they are stored in VRAM"},
+  {"patch-rom", PATCH_ROM, "ROM@ADDRESS", 0, "Write the binary output into ROM from a LoROM or HiROM address instead of files (implies --binary)"},
+  {"patch-protect", PATCH_PROTECT, 0, 0, "Refuse to overwrite ROM bytes other than $00 and $FF padding"},
+  {"patch-checksum", PATCH_CHECKSUM, 0, 0, "Update the checksum of the ROM header after patching"},
+  {"trace", TRACE, "FILE", 0, "Write a timeline of the conversion stages to FILE, in Chrome trace event format"},
+  {"manifest", MANIFEST, "FILE", 0, "Convert every outdated asset listed in FILE"},
   { 0 }
 };
 
@@ -65,6 +117,130 @@ int parse_bitplanes(char* arg)
   return bp;
 }
 
+int parse_pair(char* arg, char separator, int* first, int* second)
+{
+  char* endptr;
+
+  *first = strtol(arg, &endptr, 10);
+  if(endptr == arg || *endptr != separator)
+    return 0;
+
+  *second = strtol(endptr + 1, &endptr, 10);
+  if(*endptr != '\0')
+    return 0;
+
+  return 1;
+}
+
+int parse_tilemap_size(char* arg, int* width, int* height)
+{
+  if(!parse_pair(arg, 'x', width, height))
+    return 0;
+
+  /* Check for invalid values */
+  if((*width != 32 && *width != 64) || (*height != 32 && *height != 64))
+    return 0;
+
+  return 1;
+}
+
+int parse_obj_size(char* arg, int* small, int* large)
+{
+  if(!parse_pair(arg, ',', small, large))
+    return 0;
+
+  /* Check for sizes the PPU supports */
+  if(*small >= *large || (*small != 8 && *small != 16 && *small != 32) || (*large != 16 && *large != 32 && *large != 64))
+    return 0;
+
+  return 1;
+}
+
+int parse_region(char* arg, struct region* region)
+{
+  char* endptr = arg;
+  int values[4];
+
+  for(size_t i = 0; i < 4; i++)
+  {
+    char* start = endptr;
+
+    values[i] = strtol(start, &endptr, 10);
+    if(endptr == start || *endptr != (i == 3 ? '\0' : ','))
+      return 0;
+
+    if(i < 3)
+      endptr++;
+  }
+
+  region->x = values[0];
+  region->y = values[1];
+  region->width = values[2];
+  region->height = values[3];
+
+  /* Regions are made of whole tiles */
+  for(size_t i = 0; i < 4; i++)
+  {
+    if(values[i] < 0 || (values[i] % 8) != 0)
+      return 0;
+  }
+
+  return region->width > 0 && region->height > 0;
+}
+
+int parse_emit_spec(char* arg, struct emit_spec* spec)
+{
+  char* p = arg;
+
+  spec->bitplanes = 0;
+  spec->tilesize = 0;
+  spec->output_file = NULL;
+
+  while(*p)
+  {
+    size_t length = strcspn(p, ",");
+
+    if(strncmp(p, "bpp=", 4) == 0)
+    {
+      spec->bitplanes = strtol(p + 4, NULL, 10);
+      if(spec->bitplanes != 2 && spec->bitplanes != 4 && spec->bitplanes != 8)
+        return 0;
+    }
+    else if(strncmp(p, "tile=", 5) == 0)
+    {
+      spec->tilesize = strtol(p + 5, NULL, 10);
+      if(spec->tilesize != 8 && spec->tilesize != 16)
+        return 0;
+    }
+    else if(strncmp(p, "out=", 4) == 0 && length > 4)
+    {
+      free(spec->output_file);
+      spec->output_file = strndup(p + 4, length - 4);
+    }
+    else
+      return 0;
+
+    p += length;
+    if(*p == ',')
+      p++;
+  }
+
+  /* Variants would overwrite each other without their own basename */
+  return spec->output_file != NULL;
+}
+
+int parse_frame_size(char* arg, int* width, int* height)
+{
+  if(!parse_pair(arg, 'x', width, height))
+    return 0;
+
+  /* Frames are made of whole tiles and must fit in an OBJ offset */
+  if(*width <= 0 || *height <= 0 || (*width % 8) != 0 || (*height % 8) != 0 || *width > 256 || *height > 256)
+    return 0;
+
+  return 1;
+}
+
 /* Parse a single option. */
 error_t parse_opt (int key, char *arg, struct argp_state *state)
 {
@@ -86,12 +262,158 @@ error_t parse_opt (int key, char *arg, struct argp_state *state)
     case 'o':
       arguments->output_file = arg;
       break;
+    case SHARED_TILESET:
+      arguments->shared_tileset = 1;
+      break;
+    case SHARED_PALETTE:
+      arguments->shared_palette = 1;
+      break;
+    case TILEMAP:
+      arguments->tilemap = 1;
+      if(arg && !parse_tilemap_size(arg, &arguments->tilemap_width, &arguments->tilemap_height))
+      {
+        fprintf(stderr, "Invalid value for tilemap: %s (Possible values are 32x32, 64x32, 32x64 and 64x64)\n", arg);
+        argp_usage(state);
+        return EINVAL;
+      }
+      break;
+    case TILE_OFFSET:
+      arguments->tile_offset = parse_number(arg);
+      if(arguments->tile_offset < 0 || arguments->tile_offset > 1023)
+      {
+        fprintf(stderr, "Invalid value for tile offset: %s (Possible values are 0 to 1023)\n", arg);
+        argp_usage(state);
+        return EINVAL;
+      }
+      break;
+    case PRIORITY:
+      arguments->priority = 1;
+      break;
+    case DIRECT_COLOR:
+      arguments->direct_color = 1;
+      break;
+    case OPTIMIZE_PALETTE:
+      arguments->optimize_palette = 1;
+      break;
+    case SUPERFX:
+      arguments->superfx = parse_number(arg);
+      if(arguments->superfx != 128 && arguments->superfx != 160 && arguments->superfx != 192)
+      {
+        fprintf(stderr, "Invalid value for Super FX screen height: %s (Possible values are 128, 160 and 192)\n", arg);
+        argp_usage(state);
+        return EINVAL;
+      }
+      break;
+    case BITMAP:
+      arguments->bitmap = 1;
+      break;
+    case PACKED:
+      arguments->packed = 1;
+      break;
+    case GRADIENT:
+      arguments->gradient = parse_number(arg);
+      if(arguments->gradient < 1 || arguments->gradient > 8)
+      {
+        fprintf(stderr, "Invalid value for gradient: %s (Possible values are 1 to 8, one HDMA channel each)\n", arg);
+        argp_usage(state);
+        return EINVAL;
+      }
+      break;
+    case MAX_TILES:
+      arguments->max_tiles = parse_number(arg);
+      if(arguments->max_tiles <= 0)
+      {
+        fprintf(stderr, "Invalid value for max tiles: %s\n", arg);
+        argp_usage(state);
+        return EINVAL;
+      }
+
+      /* Reduced tiles are only usable through the BG map */
+      arguments->tilemap = 1;
+      break;
+    case DEDUP:
+      if(arg && strcmp(arg, "flip") != 0)
+      {
+        fprintf(stderr, "Invalid value for dedup: %s (Possible value is flip)\n", arg);
+        argp_usage(state);
+        return EINVAL;
+      }
+
+      arguments->dedup = DEDUP_PALETTE | (arg ? DEDUP_FLIP : 0);
+
+      /* Shared tiles are only usable through the BG map */
+      arguments->tilemap = 1;
+      break;
+    case SPLIT_LAYERS:
+      arguments->split_layers = 1;
+      arguments->tilemap = 1;
+      break;
+    case SPRITE:
+      arguments->sprite = 1;
+      break;
+    case OBJ_SIZE:
+      if(!parse_obj_size(arg, &arguments->obj_small, &arguments->obj_large))
+      {
+        fprintf(stderr, "Invalid value for OBJ size: %s (Possible values are 8,16 8,32 8,64 16,32 16,64 and 32,64)\n", arg);
+        argp_usage(state);
+        return EINVAL;
+      }
+      break;
+    case FRAME:
+      if(!parse_frame_size(arg, &arguments->frame_width, &arguments->frame_height))
+      {
+        fprintf(stderr, "Invalid value for frame: %s (Width and height must be multiples of 8 up to 256)\n", arg);
+        argp_usage(state);
+        return EINVAL;
+      }
+      break;
+    case EMIT:
+      arguments->emits = realloc(arguments->emits, (arguments->emit_count + 1) * sizeof(struct emit_spec));
+      if(!parse_emit_spec(arg, &arguments->emits[arguments->emit_count]))
+      {
+        fprintf(stderr, "Invalid value for emit: %s (Expected bpp=2|4|8, tile=8|16 and out=BASENAME)\n", arg);
+        free(arguments->emits[arguments->emit_count].output_file);
+        argp_usage(state);
+        return EINVAL;
+      }
+      arguments->emit_count++;
+      break;
+    case MODE7:
+      arguments->mode7 = 1;
+      break;
+    case TRACE:
+      arguments->trace_file = arg;
+      break;
+    case PATCH_ROM:
+      arguments->patch_rom = arg;
+      arguments->binary = 1;
+      break;
+    case PATCH_PROTECT:
+      arguments->patch_protect = 1;
+      break;
+    case PATCH_CHECKSUM:
+      arguments->patch_checksum = 1;
+      break;
+    case REGION:
+      arguments->regions = realloc(arguments->regions, (arguments->region_count + 1) * sizeof(struct region));
+      if(!parse_region(arg, &arguments->regions[arguments->region_count]))
+      {
+        fprintf(stderr, "Invalid value for region: %s (Position and size must be multiples of 8)\n", arg);
+        argp_usage(state);
+        return EINVAL;
+      }
+      arguments->region_count++;
+      break;
+    case MANIFEST:
+      arguments->manifest_file = arg;
+      break;
     case 'b':
       arguments->bitplanes = parse_bitplanes(arg);
       if(!arguments->bitplanes)
       {
         fprintf(stderr, "Invalid value for bitplanes: %s (Possible values are 2, 4 and 8)\n", arg);
         argp_usage(state);
+        return EINVAL;
       }
       break;
     case 't':
@@ -100,21 +422,54 @@ error_t parse_opt (int key, char *arg, struct argp_state *state)
       {
         fprintf(stderr, "Invalid value for bitplanes: %s (Possible values are 8 and 16)\n", arg);
         argp_usage(state);
+        return EINVAL;
       }
       break;
     case ARGP_KEY_ARG:
-      if (state->arg_num >= 1)
-        /* Too many arguments. */
-        argp_usage (state);
-
-      arguments->input_file = arg;
+      arguments->input_files = realloc(arguments->input_files, (state->arg_num + 1) * sizeof(char*));
+      arguments->input_files[state->arg_num] = arg;
+      arguments->input_count = state->arg_num + 1;
+      arguments->input_file = arguments->input_files[0];
 
       break;
 
     case ARGP_KEY_END:
-      if (state->arg_num < 1)
+      if (state->arg_num < 1 && !arguments->manifest_file)
+      {
         /* Not enough arguments. */
         argp_usage (state);
+        return EINVAL;
+      }
+
+      if (state->arg_num > 1 && !arguments->shared_tileset && !arguments->shared_palette)
+      {
+        /* Too many arguments. */
+        argp_usage (state);
+        return EINVAL;
+      }
+
+      if (arguments->manifest_file && strcmp(arguments->output_file, "-") != 0)
+      {
+        fprintf(stderr, "Entries of a manifest cannot share one output, give it in each entry instead\n");
+        argp_usage (state);
+        return EINVAL;
+      }
+
+      /* Entries that are up to date are skipped, which would move every
+         following entry to another place in the ROM */
+      if (arguments->patch_rom && arguments->manifest_file)
+      {
+        fprintf(stderr, "A ROM cannot be patched from a manifest\n");
+        argp_usage (state);
+        return EINVAL;
+      }
+
+      if (arguments->shared_tileset && arguments->shared_palette)
+      {
+        fprintf(stderr, "Shared tilesets and shared palettes cannot be combined\n");
+        argp_usage (state);
+        return EINVAL;
+      }
       break;
 
     default:
@@ -136,9 +491,82 @@ struct arguments parse_arguments(int argc, char **argv)
   arguments.output_file = "-";
   arguments.bitplanes = 0;
   arguments.tilesize = 0;
+  arguments.manifest_file = NULL;
+  arguments.shared_tileset = 0;
+  arguments.shared_palette = 0;
+  arguments.input_files = NULL;
+  arguments.tilemap = 0;
+  arguments.tilemap_width = 0;
+  arguments.tilemap_height = 0;
+  arguments.tile_offset = 0;
+  arguments.priority = 0;
+  arguments.direct_color = 0;
+  arguments.max_tiles = 0;
+  arguments.dedup = 0;
+  arguments.split_layers = 0;
+  arguments.sprite = 0;
+  arguments.obj_small = 8;
+  arguments.obj_large = 16;
+  arguments.frame_width = 0;
+  arguments.frame_height = 0;
+  arguments.mode7 = 0;
+  arguments.trace_file = NULL;
+  arguments.regions = NULL;
+  arguments.region_count = 0;
+  arguments.emits = NULL;
+  arguments.emit_count = 0;
+  arguments.optimize_palette = 0;
+  arguments.gradient = 0;
+  arguments.packed = 0;
+  arguments.superfx = 0;
+  arguments.bitmap = 0;
+  arguments.patch_rom = NULL;
+  arguments.patch_protect = 0;
+  arguments.patch_checksum = 0;
+  arguments.input_count = 0;
+
+  /* Kept so that manifest entries know which options they inherit */
+  arguments.option_count = argc - 1;
+  arguments.options = argv + 1;
 
   /* Parse our arguments; every option seen by parse_opt will
      be reflected in arguments. */
   argp_parse (&argp, argc, argv, 0, 0, &arguments);
   return arguments;
 }
+
+int parse_manifest_entry(struct arguments *arguments, int argc, char **argv)
+{
+  /* Entries inherit every option from the command line except the input */
+  arguments->input_file = NULL;
+  arguments->input_files = NULL;
+  arguments->input_count = 0;
+  arguments->manifest_file = NULL;
+
+  /* Regions belong to the image of the entry */
+  arguments->regions = NULL;
+  arguments->region_count = 0;
+  arguments->emits = NULL;
+  arguments->emit_count = 0;
+
+  /* Errors in one entry must not terminate the whole manifest */
+  if (argp_parse (&argp, argc, argv, ARGP_NO_EXIT | ARGP_NO_HELP, 0, arguments) != 0)
+    return -1;
+
+  if (!arguments->input_file)
+    return -1;
+
+  if (arguments->manifest_file)
+  {
+    fprintf(stderr, "Manifests cannot be nested\n");
+    return -1;
+  }
+
+  if (arguments->patch_rom)
+  {
+    fprintf(stderr, "A ROM cannot be patched from a manifest\n");
+    return -1;
+  }
+
+  return 0;
+}
@@ -1,18 +1,73 @@
 #ifndef ARG_PARSER_H
 #define  ARG_PARSER_H
 
+  /* Tile-aligned part of the image, in pixels */
+  struct region
+  {
+    int x;
+    int y;
+    int width;
+    int height;
+  };
+
+  /* Output variant converted from the same decoded image */
+  struct emit_spec
+  {
+    int bitplanes;
+    int tilesize;
+    char *output_file;
+  };
+
   /* Supplied arguments */
   struct arguments
   {
     int verbose;
     int binary;
     char *input_file;
+    char **input_files;
+    int input_count;
     char *output_file;
     int bitplanes;
     int tilesize;
+    char *manifest_file;
+    int option_count;
+    char **options;
+    int shared_tileset;
+    int shared_palette;
+    int tilemap;
+    int tilemap_width;
+    int tilemap_height;
+    int tile_offset;
+    int priority;
+    int direct_color;
+    int max_tiles;
+    int sprite;
+    int obj_small;
+    int obj_large;
+    int frame_width;
+    int frame_height;
+    int mode7;
+    char *trace_file;
+    struct region *regions;
+    int region_count;
+    struct emit_spec *emits;
+    int emit_count;
+    int optimize_palette;
+    int gradient;
+    int packed;
+    int superfx;
+    int bitmap;
+    char *patch_rom;
+    int patch_protect;
+    int patch_checksum;
+    int dedup;
+    int split_layers;
   };
 
   /* Argument parser */
   struct arguments parse_arguments(int argc, char **argv);
 
+  /* Parse a manifest entry on top of default arguments. Returns 0 on success */
+  int parse_manifest_entry(struct arguments *arguments, int argc, char **argv);
+
 #endif //ARG_PARSER_H
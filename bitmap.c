@@ -0,0 +1,77 @@
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitmap.h"
+#include "tile.h"
+#include "tilemap.h"
+#include "trace.h"
+
+//Characters in the order the Super FX PLOT circuit uses them: each column
+//of the screen is a run of screen_height / 8 characters, top to bottom.
+//Parts of the screen outside the image stay blank.
+uint8_t* convert_superfx(const uint8_t* tiles, unsigned int columns, unsigned int rows, unsigned int bitplane_count, unsigned int screen_height, struct tilemap* map, unsigned int* data_size)
+{
+  unsigned int column_characters = screen_height / 8;
+  unsigned int bytes_per_tile = 8 * bitplane_count;
+  uint8_t* data;
+
+  if(columns > SUPERFX_COLUMNS || rows > column_characters)
+  {
+    fprintf(stderr, "Image is %ux%u tiles, Super FX screen only holds %ux%u\n", columns, rows, SUPERFX_COLUMNS, column_characters);
+    return NULL;
+  }
+
+  *data_size = columns * column_characters * bytes_per_tile;
+  data = calloc(*data_size, 1);
+
+  TRACE_PROBE(convert_start, bitplane_count, screen_height);
+
+  for(size_t i = 0, k = 0; i < rows; i++)
+  {
+    for(size_t j = 0; j < columns; j++, k++)
+    {
+      unsigned int character = (j * column_characters) + i;
+
+      convert_to_bitplanes(data + (character * bytes_per_tile), tiles + (k * TILE_SIZE), bitplane_count);
+
+      if(map)
+        tilemap_set(map, j, i, character, tile_palette(tiles + (k * TILE_SIZE), bitplane_count), 0);
+    }
+  }
+
+  TRACE_PROBE(convert_done, bitplane_count, *data_size);
+
+  return data;
+}
+
+//Row-major bitmap with the pixels of each byte packed from the low bits,
+//leftmost pixel first, as read by SA-1 character conversion
+uint8_t* convert_linear_bitmap(png_bytepp row_pointers, unsigned int width, unsigned int height, unsigned int bitplane_count, unsigned int* data_size)
+{
+  unsigned int pixels_per_byte = 8 / bitplane_count;
+  unsigned int row_bytes = width / pixels_per_byte;
+  unsigned int mask = (1 << bitplane_count) - 1;
+  uint8_t* data;
+
+  if(width % pixels_per_byte)
+  {
+    fprintf(stderr, "Bitmap width must be a multiple of %u pixels\n", pixels_per_byte);
+    return NULL;
+  }
+
+  *data_size = row_bytes * height;
+  data = calloc(*data_size, 1);
+
+  for(size_t y = 0; y < height; y++)
+  {
+    uint8_t* destination = data + (y * row_bytes);
+
+    for(size_t x = 0; x < width; x++)
+      destination[x / pixels_per_byte] |= (row_pointers[y][x] & mask) << ((x % pixels_per_byte) * bitplane_count);
+  }
+
+  return data;
+}
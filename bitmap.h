@@ -0,0 +1,12 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+#include <stdint.h>
+
+struct tilemap;
+uint8_t* convert_superfx(const uint8_t* tiles, unsigned int columns, unsigned int rows, unsigned int bitplane_count, unsigned int screen_height, struct tilemap* map, unsigned int* data_size);
+uint8_t* convert_linear_bitmap(png_bytepp row_pointers, unsigned int width, unsigned int height, unsigned int bitplane_count, unsigned int* data_size);
+
+/* Super FX screens are 32 characters wide */
+#define SUPERFX_COLUMNS 32
+
+#endif //BITMAP_H
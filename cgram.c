@@ -0,0 +1,188 @@
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cgram.h"
+
+//Find the colors used by every sub-palette of an image. Index 0 of each
+//sub-palette is transparent and never needs a color. Returns the number of
+//sub-palettes in use.
+unsigned int collect_subpalettes(png_bytepp row_pointers, unsigned int width, unsigned int height, const uint16_t* palette, unsigned int bitplane_count, unsigned int asset, struct subpalette* subpalettes)
+{
+  unsigned int slot_size = 1 << bitplane_count;
+  unsigned int count = 0;
+  uint8_t used[CGRAM_COLORS];
+
+  memset(used, 0, sizeof(used));
+
+  for(size_t y = 0; y < height; y++)
+  {
+    for(size_t x = 0; x < width; x++)
+      used[row_pointers[y][x]] = 1;
+  }
+
+  for(unsigned int number = 0; number < CGRAM_COLORS / slot_size; number++)
+  {
+    struct subpalette* subpalette = &subpalettes[count];
+
+    memset(subpalette, 0, sizeof(struct subpalette));
+    subpalette->asset = asset;
+    subpalette->number = number;
+    subpalette->slot = -1;
+
+    for(unsigned int i = 1; i < slot_size; i++)
+    {
+      uint16_t color = palette[(number * slot_size) + i];
+      int found = 0;
+
+      if(!used[(number * slot_size) + i])
+        continue;
+
+      subpalette->used[i] = 1;
+      subpalette->index_color[i] = color;
+
+      //Identical colors only take one entry
+      for(unsigned int j = 0; j < subpalette->count && !found; j++)
+        found = subpalette->colors[j] == color;
+
+      if(!found)
+        subpalette->colors[subpalette->count++] = color;
+    }
+
+    if(subpalette->count > 0 || used[number * slot_size])
+      count++;
+  }
+
+  return count;
+}
+
+int compare_subpalettes(const void* a, const void* b)
+{
+  const struct subpalette* first = *(const struct subpalette**)a;
+  const struct subpalette* second = *(const struct subpalette**)b;
+
+  //Largest first, in input order otherwise
+  if(first->count != second->count)
+    return (int)second->count - (int)first->count;
+
+  if(first->asset != second->asset)
+    return (int)first->asset - (int)second->asset;
+
+  return (int)first->number - (int)second->number;
+}
+
+int slot_position(const uint16_t* slot, unsigned int size, uint16_t color)
+{
+  for(unsigned int i = 1; i < size; i++)
+  {
+    if(slot[i] == color)
+      return i;
+  }
+
+  return -1;
+}
+
+//Pack sub-palettes into CGRAM slots. Each sub-palette goes to the slot
+//that already holds the most of its colors, as long as the union fits, so
+//identical sub-palettes and shared colors are only stored once. Fills the
+//remap table of every sub-palette. Returns 0 on success.
+int pack_subpalettes(struct subpalette* subpalettes, unsigned int count, unsigned int bitplane_count, uint16_t* cgram, unsigned int* slot_count)
+{
+  unsigned int slot_size = 1 << bitplane_count;
+  unsigned int max_slots = bitplane_count >= 8 ? 1 : CGRAM_MAX_SLOTS;
+  unsigned int used_colors[CGRAM_MAX_SLOTS];
+  struct subpalette** order = malloc(count * sizeof(struct subpalette*));
+
+  memset(used_colors, 0, sizeof(used_colors));
+  memset(cgram, 0, CGRAM_COLORS * sizeof(uint16_t));
+  *slot_count = 0;
+
+  for(unsigned int i = 0; i < count; i++)
+    order[i] = &subpalettes[i];
+
+  qsort(order, count, sizeof(struct subpalette*), compare_subpalettes);
+
+  for(unsigned int i = 0; i < count; i++)
+  {
+    struct subpalette* subpalette = order[i];
+    int best_slot = -1, best_overlap = -1;
+
+    for(unsigned int slot = 0; slot < *slot_count; slot++)
+    {
+      int overlap = 0;
+
+      for(unsigned int j = 0; j < subpalette->count; j++)
+        overlap += slot_position(cgram + (slot * slot_size), used_colors[slot] + 1, subpalette->colors[j]) >= 0;
+
+      if(used_colors[slot] + subpalette->count - overlap < slot_size && overlap > best_overlap)
+      {
+        best_slot = slot;
+        best_overlap = overlap;
+      }
+    }
+
+    if(best_slot < 0)
+    {
+      if(*slot_count == max_slots)
+      {
+        fprintf(stderr, "Palettes do not fit in %u slots of %u colors\n", max_slots, slot_size);
+        free(order);
+        return -1;
+      }
+
+      best_slot = (*slot_count)++;
+    }
+
+    //Add the missing colors at the end of the slot
+    for(unsigned int j = 0; j < subpalette->count; j++)
+    {
+      uint16_t* slot = cgram + (best_slot * slot_size);
+
+      if(slot_position(slot, used_colors[best_slot] + 1, subpalette->colors[j]) < 0)
+        slot[++used_colors[best_slot]] = subpalette->colors[j];
+    }
+
+    subpalette->slot = best_slot;
+    for(unsigned int j = 1; j < slot_size; j++)
+    {
+      if(subpalette->used[j])
+        subpalette->remap[j] = slot_position(cgram + (best_slot * slot_size), used_colors[best_slot] + 1, subpalette->index_color[j]);
+    }
+  }
+
+  free(order);
+
+  return 0;
+}
+
+//Rewrite the pixels of an asset to point into the packed slots
+void remap_to_slots(png_bytepp row_pointers, unsigned int width, unsigned int height, const struct subpalette* subpalettes, unsigned int count, unsigned int bitplane_count)
+{
+  unsigned int slot_size = 1 << bitplane_count;
+  uint8_t table[CGRAM_COLORS];
+
+  //Unused sub-palettes keep their pixels as they are
+  for(unsigned int i = 0; i < CGRAM_COLORS; i++)
+    table[i] = i;
+
+  for(unsigned int i = 0; i < count; i++)
+  {
+    const struct subpalette* subpalette = &subpalettes[i];
+    unsigned int first = subpalette->number * slot_size;
+
+    table[first] = subpalette->slot * slot_size;
+    for(unsigned int j = 1; j < slot_size; j++)
+    {
+      if(subpalette->used[j])
+        table[first + j] = (subpalette->slot * slot_size) + subpalette->remap[j];
+    }
+  }
+
+  for(size_t y = 0; y < height; y++)
+  {
+    for(size_t x = 0; x < width; x++)
+      row_pointers[y][x] = table[row_pointers[y][x]];
+  }
+}
@@ -0,0 +1,27 @@
+#ifndef CGRAM_H
+#define CGRAM_H
+#include <stdint.h>
+
+/* Colors used by one sub-palette of an asset */
+struct subpalette
+{
+  unsigned int asset;
+  unsigned int number;
+  unsigned int count;
+  uint16_t colors[256];
+
+  /* Color of every index of the sub-palette, and index in its slot */
+  uint16_t index_color[256];
+  uint8_t used[256];
+  uint8_t remap[256];
+  int slot;
+};
+
+unsigned int collect_subpalettes(png_bytepp row_pointers, unsigned int width, unsigned int height, const uint16_t* palette, unsigned int bitplane_count, unsigned int asset, struct subpalette* subpalettes);
+int pack_subpalettes(struct subpalette* subpalettes, unsigned int count, unsigned int bitplane_count, uint16_t* cgram, unsigned int* slot_count);
+void remap_to_slots(png_bytepp row_pointers, unsigned int width, unsigned int height, const struct subpalette* subpalettes, unsigned int count, unsigned int bitplane_count);
+
+#define CGRAM_COLORS 256
+#define CGRAM_MAX_SLOTS 8
+
+#endif //CGRAM_H
@@ -0,0 +1,195 @@
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "direct.h"
+#include "palette.h"
+
+//Nearest BBGGGRRR value of every BGR15 color, for each set of palette bits
+static uint8_t lut[DIRECT_COLOR_PALETTES][BGR15_COLORS];
+static int lut_initialized = 0;
+
+//Find the nearest value of a channel made of its high bits and one low bit
+unsigned int nearest_channel(unsigned int value, unsigned int extra, unsigned int shift, unsigned int max)
+{
+  int high = ((int)value - (int)extra + (1 << (shift - 1))) >> shift;
+
+  if(high < 0)
+    return 0;
+
+  return (unsigned int)high > max ? max : (unsigned int)high;
+}
+
+void init_direct_color_lut()
+{
+  for(unsigned int p = 0; p < DIRECT_COLOR_PALETTES; p++)
+  {
+    for(unsigned int color = 0; color < BGR15_COLORS; color++)
+    {
+      unsigned int red = nearest_channel(color & 0x1F, (p & 0x01) << 1, 2, 7);
+      unsigned int green = nearest_channel((color >> 5) & 0x1F, (p & 0x02), 2, 7);
+      unsigned int blue = nearest_channel(color >> 10, (p & 0x04), 3, 3);
+
+      lut[p][color] = (blue << 6) | (green << 3) | red;
+    }
+  }
+
+  lut_initialized = 1;
+}
+
+const uint8_t* direct_color_lut(unsigned int palette_bits)
+{
+  if(!lut_initialized)
+    init_direct_color_lut();
+
+  return lut[palette_bits];
+}
+
+//Palette bits of the BG map entry hold the low bit of each channel:
+//R = RRRr0, G = GGGg0, B = BBb00
+uint16_t direct_color_to_bgr15(uint8_t color, unsigned int palette_bits)
+{
+  unsigned int red = ((color & 0x07) << 2) | ((palette_bits & 0x01) << 1);
+  unsigned int green = (((color >> 3) & 0x07) << 2) | (palette_bits & 0x02);
+  unsigned int blue = ((color >> 6) << 3) | (palette_bits & 0x04);
+
+  return (blue << 10) | (green << 5) | red;
+}
+
+unsigned int bgr15_distance(uint16_t a, uint16_t b)
+{
+  int red = (int)(a & 0x1F) - (int)(b & 0x1F);
+  int green = (int)((a >> 5) & 0x1F) - (int)((b >> 5) & 0x1F);
+  int blue = (int)(a >> 10) - (int)(b >> 10);
+
+  return (red * red) + (green * green) + (blue * blue);
+}
+
+//Convert every row to BGR15 in place. Transparent pixels become 0xFFFF.
+uint16_t** read_bgr15_rows(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers)
+{
+  unsigned int height = png_get_image_height(png_ptr, info_ptr);
+  unsigned int width = png_get_image_width(png_ptr, info_ptr);
+  unsigned int channels = png_get_channels(png_ptr, info_ptr);
+  uint16_t palette[256], *row;
+  uint16_t** rows = malloc(height * sizeof(uint16_t*));
+
+  if(png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_PALETTE)
+  {
+    png_color* png_palette;
+    int palette_size;
+
+    png_get_PLTE(png_ptr, info_ptr, &png_palette, &palette_size);
+
+    memset(palette, 0, sizeof(palette));
+    for(int i = 0; i < palette_size; i++)
+      palette[i] = CONVERT_TO_BGR15(png_palette[i].red, png_palette[i].green, png_palette[i].blue);
+
+    //Color 0 stays transparent
+    palette[0] = 0xFFFF;
+  }
+
+  for(size_t y = 0; y < height; y++)
+  {
+    const png_byte* source = row_pointers[y];
+
+    row = rows[y] = malloc(width * sizeof(uint16_t));
+
+    if(png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_PALETTE)
+    {
+      for(size_t x = 0; x < width; x++)
+        row[x] = palette[source[x]];
+    }
+    else
+    {
+      for(size_t x = 0; x < width; x++, source += channels)
+      {
+        row[x] = CONVERT_TO_BGR15(source[0], source[1], source[2]);
+
+        if(channels == 4 && source[3] < 0x80)
+          row[x] = 0xFFFF;
+      }
+    }
+  }
+
+  return rows;
+}
+
+//Palette bits giving the least error over a cell of the image
+unsigned int select_palette_bits(uint16_t** rows, unsigned int x, unsigned int y, unsigned int tilesize)
+{
+  unsigned int best = 0, best_error = ~0u;
+
+  for(unsigned int p = 0; p < DIRECT_COLOR_PALETTES; p++)
+  {
+    const uint8_t* table = direct_color_lut(p);
+    unsigned int error = 0;
+
+    for(size_t i = 0; i < tilesize; i++)
+    {
+      for(size_t j = 0; j < tilesize; j++)
+      {
+        uint16_t color = rows[y + i][x + j];
+
+        if(color != 0xFFFF)
+          error += bgr15_distance(color, direct_color_to_bgr15(table[color], p));
+      }
+    }
+
+    if(error < best_error)
+    {
+      best = p;
+      best_error = error;
+    }
+  }
+
+  return best;
+}
+
+//Replace every pixel with its nearest direct color value, one byte per pixel.
+//When select_palettes is set, the palette bits of each cell are chosen to
+//reduce the error and returned, one byte per cell.
+uint8_t* convert_to_direct_color(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int tilesize, int select_palettes)
+{
+  unsigned int height = png_get_image_height(png_ptr, info_ptr);
+  unsigned int width = png_get_image_width(png_ptr, info_ptr);
+  unsigned int horizontal_tiles = width / tilesize;
+  unsigned int vertical_tiles = height / tilesize;
+  uint8_t* palettes = calloc((horizontal_tiles * vertical_tiles) + 1, 1);
+  uint16_t** rows = read_bgr15_rows(png_ptr, info_ptr, row_pointers);
+
+  if(select_palettes)
+  {
+    for(size_t i = 0, k = 0; i < vertical_tiles; i++)
+    {
+      for(size_t j = 0; j < horizontal_tiles; j++, k++)
+        palettes[k] = select_palette_bits(rows, j * tilesize, i * tilesize, tilesize);
+    }
+  }
+
+  //A single table lookup per pixel, with the table of the cell's palette bits
+  for(size_t y = 0; y < height; y++)
+  {
+    const uint16_t* source = rows[y];
+    png_bytep destination = row_pointers[y];
+    unsigned int row = (y / tilesize) < vertical_tiles ? (y / tilesize) : 0;
+
+    for(size_t x = 0; x < width; x += tilesize)
+    {
+      unsigned int column = (x / tilesize) < horizontal_tiles ? (x / tilesize) : 0;
+      const uint8_t* table = direct_color_lut(palettes[(row * horizontal_tiles) + column]);
+      size_t end = (x + tilesize) < width ? (x + tilesize) : width;
+
+      for(size_t i = x; i < end; i++)
+        destination[i] = source[i] == 0xFFFF ? 0 : table[source[i]];
+    }
+
+    free(rows[y]);
+  }
+
+  free(rows);
+
+  return palettes;
+}
@@ -0,0 +1,12 @@
+#ifndef DIRECT_H
+#define DIRECT_H
+#include <stdint.h>
+
+const uint8_t* direct_color_lut(unsigned int palette_bits);
+uint16_t direct_color_to_bgr15(uint8_t color, unsigned int palette_bits);
+uint8_t* convert_to_direct_color(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int tilesize, int select_palettes);
+
+#define DIRECT_COLOR_PALETTES 8
+#define BGR15_COLORS 32768
+
+#endif //DIRECT_H
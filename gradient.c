@@ -0,0 +1,280 @@
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gradient.h"
+#include "output.h"
+#include "palette.h"
+
+void gradient_init(struct gradient* gradient, unsigned int bitplane_count, unsigned int max_writes)
+{
+  memset(gradient, 0, sizeof(struct gradient));
+  gradient->slot_size = 1 << bitplane_count;
+  gradient->max_writes = max_writes;
+
+  //Slot holding every BGR15 color, -1 when it is not loaded
+  gradient->slot_of = malloc(BGR15_INDEX_SIZE * sizeof(int16_t));
+  for(size_t i = 0; i < BGR15_INDEX_SIZE; i++)
+    gradient->slot_of[i] = -1;
+
+  //Color 0 is transparent and never changes
+  gradient->loaded[0] = 1;
+}
+
+void gradient_free(struct gradient* gradient)
+{
+  free(gradient->slot_of);
+  free(gradient->writes);
+}
+
+void add_write(struct gradient* gradient, unsigned int slot, unsigned int channel, uint16_t color)
+{
+  if(gradient->write_count == gradient->write_capacity)
+  {
+    gradient->write_capacity = gradient->write_capacity ? gradient->write_capacity * 2 : 64;
+    gradient->writes = realloc(gradient->writes, gradient->write_capacity * sizeof(struct hdma_write));
+  }
+
+  gradient->writes[gradient->write_count++] = (struct hdma_write){ gradient->line, slot, channel, color };
+}
+
+int needed_later(uint16_t needed[][256], unsigned int* needed_count, unsigned int first, unsigned int last, uint16_t color)
+{
+  for(size_t y = first; y < last; y++)
+  {
+    for(size_t i = 0; i < needed_count[y]; i++)
+    {
+      if(needed[y][i] == color)
+        return 1;
+    }
+  }
+
+  return 0;
+}
+
+//Pick the slot that receives a color missing from the current line. Slots
+//never used so far are free since their first color goes in the base
+//palette. Otherwise, evict a color the rest of the band does not need,
+//least recently used first.
+int choose_slot(struct gradient* gradient, uint16_t needed[][256], unsigned int* needed_count, unsigned int y, unsigned int height)
+{
+  int best = -1, best_later = 0;
+
+  for(size_t slot = 1; slot < gradient->slot_size; slot++)
+  {
+    int later;
+
+    if(!gradient->loaded[slot])
+      return slot;
+
+    //Colors of the current line stay
+    if(gradient->last_use[slot] == gradient->line + 1)
+      continue;
+
+    later = needed_later(needed, needed_count, y + 1, height, gradient->colors[slot]);
+
+    if(best < 0 || later < best_later || (later == best_later && gradient->last_use[slot] < gradient->last_use[best]))
+    {
+      best = slot;
+      best_later = later;
+    }
+  }
+
+  return best;
+}
+
+//Assign the colors of a band of scanlines to slots and remap its pixels in
+//place. Only the rows of the band are looked at.
+void gradient_add_band(struct gradient* gradient, png_bytepp row_pointers, unsigned int width, unsigned int height, const uint16_t* palette)
+{
+  uint16_t needed[GRADIENT_BAND_HEIGHT][256];
+  unsigned int needed_count[GRADIENT_BAND_HEIGHT];
+
+  //Distinct colors of every line, pixels using entry 0 are transparent
+  for(size_t y = 0; y < height; y++)
+  {
+    uint8_t used[256];
+
+    memset(used, 0, sizeof(used));
+    needed_count[y] = 0;
+
+    for(size_t x = 0; x < width; x++)
+      used[row_pointers[y][x]] = 1;
+
+    for(size_t i = 1; i < 256; i++)
+    {
+      int found = 0;
+
+      if(!used[i])
+        continue;
+
+      for(size_t j = 0; j < needed_count[y] && !found; j++)
+        found = needed[y][j] == palette[i];
+
+      if(!found)
+        needed[y][needed_count[y]++] = palette[i];
+    }
+  }
+
+  for(size_t y = 0; y < height; y++)
+  {
+    unsigned int write_count = 0;
+
+    //Last use is stored as line + 1 so that 0 means never
+    for(size_t i = 0; i < needed_count[y]; i++)
+    {
+      int slot = gradient->slot_of[needed[y][i]];
+
+      if(slot >= 0)
+        gradient->last_use[slot] = gradient->line + 1;
+    }
+
+    if(needed_count[y] >= gradient->slot_size)
+    {
+      fprintf(stderr, "Line %u uses %u colors, only %u fit\n", gradient->line, needed_count[y], gradient->slot_size - 1);
+      gradient->conflicts++;
+    }
+
+    for(size_t i = 0; i < needed_count[y]; i++)
+    {
+      uint16_t color = needed[y][i];
+      int slot;
+
+      if(gradient->slot_of[color] >= 0)
+        continue;
+
+      slot = choose_slot(gradient, needed, needed_count, y, height);
+      if(slot < 0)
+        break;
+
+      if(gradient->loaded[slot])
+      {
+        gradient->slot_of[gradient->colors[slot]] = -1;
+        add_write(gradient, slot, write_count++, color);
+      }
+      else
+      {
+        gradient->loaded[slot] = 1;
+        gradient->base[slot] = color;
+      }
+
+      gradient->colors[slot] = color;
+      gradient->slot_of[color] = slot;
+      gradient->last_use[slot] = gradient->line + 1;
+    }
+
+    if(write_count > gradient->max_writes)
+    {
+      fprintf(stderr, "Line %u needs %u CGRAM writes, at most %u fit\n", gradient->line, write_count, gradient->max_writes);
+      gradient->conflicts++;
+    }
+
+    for(size_t x = 0; x < width; x++)
+    {
+      uint8_t index = row_pointers[y][x];
+      int slot = index ? gradient->slot_of[palette[index]] : 0;
+
+      row_pointers[y][x] = slot < 0 ? 0 : slot;
+    }
+
+    gradient->line++;
+  }
+}
+
+uint8_t* add_entry(uint8_t* p, unsigned int lines, unsigned int slot, uint16_t color)
+{
+  *p++ = lines;
+  *p++ = slot;
+  *p++ = slot;
+  *p++ = color & 0xFF;
+  *p++ = color >> 8;
+
+  return p;
+}
+
+//One table per HDMA channel, each ending with a 0 byte. Every entry writes
+//one color in transfer mode 3 ($2121 twice then $2122 twice) and holds it
+//for up to 127 lines. Gaps are filled by rewriting color 0, which never
+//changes.
+uint8_t* gradient_hdma_tables(const struct gradient* gradient, unsigned int* size)
+{
+  unsigned int entry_count = 0;
+  uint8_t *data, *p;
+
+  //Every write and every 127 line span may need an entry on every channel
+  entry_count = gradient->write_count + ((gradient->line / HDMA_MAX_LINES) + 2) * gradient->max_writes;
+  data = malloc((entry_count * HDMA_ENTRY_SIZE) + gradient->max_writes);
+  p = data;
+
+  for(unsigned int channel = 0; channel < gradient->max_writes; channel++)
+  {
+    unsigned int start = 0, slot = 0;
+    uint16_t color = gradient->base[0];
+
+    for(size_t i = 0; i <= gradient->write_count; i++)
+    {
+      const struct hdma_write* write = i < gradient->write_count ? &gradient->writes[i] : NULL;
+      unsigned int end = write ? write->line : gradient->line;
+
+      if(write && write->channel != channel)
+        continue;
+
+      //Hold the previous write until this one, the first span starts at the top
+      for(int first = 1; end > start; first = 0)
+      {
+        unsigned int lines = end - start > HDMA_MAX_LINES ? HDMA_MAX_LINES : end - start;
+
+        p = first ? add_entry(p, lines, slot, color) : add_entry(p, lines, 0, gradient->base[0]);
+        start += lines;
+      }
+
+      if(write)
+      {
+        slot = write->slot;
+        color = write->color;
+      }
+    }
+
+    *p++ = 0;
+  }
+
+  *size = p - data;
+
+  return data;
+}
+
+void output_hdma_binary(char* basename, uint8_t* data, int bytes)
+{
+  FILE* fp = open_output(basename, ".hdm", 1);
+
+  if(!fp)
+    return;
+
+  fwrite(data, 1, bytes, fp);
+  close_output(fp);
+}
+
+void output_hdma_wla(char* basename, uint8_t* data, int bytes)
+{
+  FILE* fp = open_output(basename, "_hdma.asm", 0);
+
+  if(!fp)
+    return;
+
+  for(size_t i = 0; i < bytes; i++)
+  {
+    if((i & 0x0F) == 0)
+      fprintf(fp, "\n\t.db ");
+
+    fprintf(fp, "$%02X", data[i]);
+
+    if(((i & 0x0F) < 15) && (i < (bytes-1)))
+        fprintf(fp, ", ");
+  }
+
+  fprintf(fp, "\n");
+
+  close_output(fp);
+}
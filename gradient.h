@@ -0,0 +1,42 @@
+#ifndef GRADIENT_H
+#define GRADIENT_H
+#include <stdint.h>
+
+/* CGRAM write done by HDMA before a scanline */
+struct hdma_write
+{
+  unsigned int line;
+  unsigned int slot;
+  unsigned int channel;
+  uint16_t color;
+};
+
+/* Colors held by the slots of a sub-palette while going down the image */
+struct gradient
+{
+  unsigned int slot_size;
+  unsigned int max_writes;
+  unsigned int line;
+  unsigned int conflicts;
+  uint16_t colors[256];
+  uint16_t base[256];
+  uint8_t loaded[256];
+  unsigned int last_use[256];
+  int16_t* slot_of;
+  struct hdma_write* writes;
+  unsigned int write_count;
+  unsigned int write_capacity;
+};
+
+void gradient_init(struct gradient* gradient, unsigned int bitplane_count, unsigned int max_writes);
+void gradient_free(struct gradient* gradient);
+void gradient_add_band(struct gradient* gradient, png_bytepp row_pointers, unsigned int width, unsigned int height, const uint16_t* palette);
+uint8_t* gradient_hdma_tables(const struct gradient* gradient, unsigned int* size);
+void output_hdma_binary(char* basename, uint8_t* data, int bytes);
+void output_hdma_wla(char* basename, uint8_t* data, int bytes);
+
+#define GRADIENT_BAND_HEIGHT 8
+#define HDMA_MAX_LINES 127
+#define HDMA_ENTRY_SIZE 5
+
+#endif //GRADIENT_H
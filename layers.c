@@ -0,0 +1,118 @@
+#include <png.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "layers.h"
+#include "parallel.h"
+#include "tile.h"
+
+struct layer_context
+{
+  const uint8_t* tiles;
+  uint8_t* front;
+  uint8_t* back;
+  struct layer_split* splits;
+
+  /* Sub-palettes holding the color of each palette entry, and its slot there */
+  uint8_t masks[256];
+  uint8_t slots[256][LAYER_SUBPALETTES];
+};
+
+//Pick the pair of sub-palettes drawing the most pixels of each tile. A
+//single sub-palette is preferred, leaving the back layer empty.
+void split_tile_range(void* arg, unsigned int start, unsigned int end)
+{
+  struct layer_context* context = arg;
+
+  for(unsigned int i = start; i < end; i++)
+  {
+    const uint8_t* tile = context->tiles + (i * TILE_SIZE);
+    uint8_t* front = context->front + (i * TILE_SIZE);
+    uint8_t* back = context->back + (i * TILE_SIZE);
+    struct layer_split* split = &context->splits[i];
+    unsigned int best_missing = TILE_SIZE + 1;
+
+    for(unsigned int a = 0; a < LAYER_SUBPALETTES && best_missing > 0; a++)
+    {
+      for(unsigned int b = a; b < LAYER_SUBPALETTES && best_missing > 0; b++)
+      {
+        uint8_t pair = (1 << a) | (1 << b);
+        unsigned int missing = 0;
+
+        for(size_t j = 0; j < TILE_SIZE; j++)
+        {
+          if(tile[j] != 0 && !(context->masks[tile[j]] & pair))
+            missing++;
+        }
+
+        if(missing < best_missing)
+        {
+          best_missing = missing;
+          split->front_palette = a;
+          split->back_palette = b;
+        }
+      }
+    }
+
+    //Pixels no sub-palette of the pair holds stay transparent
+    for(size_t j = 0; j < TILE_SIZE; j++)
+    {
+      uint8_t mask = tile[j] ? context->masks[tile[j]] : 0;
+
+      front[j] = back[j] = 0;
+
+      if(mask & (1 << split->front_palette))
+        front[j] = context->slots[tile[j]][split->front_palette];
+      else if(mask & (1 << split->back_palette))
+        back[j] = context->slots[tile[j]][split->back_palette];
+    }
+
+    split->conflicts = best_missing;
+  }
+}
+
+//Split 8x8 chunky tiles using the colors of up to 8 sub-palettes over a
+//front and a back layer of 4bpp tiles. Colors are matched by value, so a
+//color can be drawn from any sub-palette holding it. Returns the number of
+//tiles needing more than two sub-palettes.
+unsigned int split_layers(const uint8_t* tiles, unsigned int tile_count, const uint16_t* palette, unsigned int color_count, uint8_t* front, uint8_t* back, struct layer_split* splits)
+{
+  struct layer_context* context = calloc(1, sizeof(struct layer_context));
+  unsigned int conflicting = 0;
+
+  context->tiles = tiles;
+  context->front = front;
+  context->back = back;
+  context->splits = splits;
+
+  if(color_count > LAYER_SUBPALETTES * LAYER_COLORS)
+    color_count = LAYER_SUBPALETTES * LAYER_COLORS;
+
+  //Color 0 of each sub-palette is transparent and cannot be drawn
+  for(unsigned int i = 0; i < 256; i++)
+  {
+    for(unsigned int j = 0; j < color_count; j++)
+    {
+      unsigned int subpalette = j / LAYER_COLORS;
+
+      if((j % LAYER_COLORS) != 0 && palette[j] == palette[i] && !(context->masks[i] & (1 << subpalette)))
+      {
+        context->masks[i] |= 1 << subpalette;
+        context->slots[i][subpalette] = j % LAYER_COLORS;
+      }
+    }
+  }
+
+  parallel_for(tile_count, 64, split_tile_range, context);
+
+  for(unsigned int i = 0; i < tile_count; i++)
+  {
+    if(splits[i].conflicts)
+      conflicting++;
+  }
+
+  free(context);
+
+  return conflicting;
+}
@@ -0,0 +1,20 @@
+#ifndef LAYERS_H
+#define LAYERS_H
+#include <stdint.h>
+
+/* Sub-palettes of a tile split over two 4bpp BG layers. Color 0 of the
+   front layer shows the back layer, so each pixel is drawn by one of them. */
+struct layer_split
+{
+  uint8_t front_palette;
+  uint8_t back_palette;
+  unsigned int conflicts;
+};
+
+unsigned int split_layers(const uint8_t* tiles, unsigned int tile_count, const uint16_t* palette, unsigned int color_count, uint8_t* front, uint8_t* back, struct layer_split* splits);
+
+/* Sub-palettes a 4bpp BG can use, and the colors in each */
+#define LAYER_SUBPALETTES 8
+#define LAYER_COLORS 16
+
+#endif //LAYERS_H
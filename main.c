@@ -2,20 +2,106 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #include "argparser.h"
+#include "bitmap.h"
+#include "cgram.h"
+#include "direct.h"
+#include "gradient.h"
+#include "layers.h"
+#include "main.h"
+#include "manifest.h"
+#include "mode7.h"
+#include "output.h"
+#include "packed.h"
 #include "palette.h"
 #include "pngfunctions.h"
+#include "reduce.h"
+#include "rom.h"
+#include "shared.h"
+#include "sprite.h"
 #include "tile.h"
+#include "tilemap.h"
+#include "trace.h"
 
 #define DEFAULT_TILE_SIZE 8
 
+int check_options(png_structp png_ptr, png_infop info_ptr, struct arguments args);
+int check_layout_size(unsigned int width, unsigned int height, unsigned int bitplane_count, unsigned int tilesize, struct arguments args);
+unsigned int last_map_character(unsigned int width, unsigned int height, unsigned int tilesize, struct arguments args);
+int cgram_size(png_structp png_ptr, png_infop info_ptr, struct arguments args);
 int generate_cgram(png_structp png_ptr, png_infop info_ptr, struct arguments args);
-void generate_vram(png_structp png_ptr, png_infop info_ptr, struct arguments args);
+int convert_optimized(png_structp png_ptr, png_infop info_ptr, struct arguments args);
+int convert_mode7_image(png_structp png_ptr, png_infop info_ptr, struct arguments args);
+int convert_gradient(png_structp png_ptr, png_infop info_ptr, struct arguments args);
+int convert_split_layers(png_structp png_ptr, png_infop info_ptr, struct arguments args);
+int build_layer(uint8_t* tiles, const struct layer_split* splits, unsigned int columns, unsigned int rows, int back, struct tilemap* map, uint8_t** data, unsigned int* data_size, struct arguments args);
+int generate_layer(struct tilemap* map, uint8_t* data, unsigned int data_size, int back, struct arguments args);
+int generate_vram(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, struct arguments args);
+int generate_regions(png_structp png_ptr, png_infop info_ptr, struct arguments args);
+int generate_variants(png_structp png_ptr, png_infop info_ptr, struct arguments args);
+void init_tilemap(struct tilemap* map, unsigned int columns, unsigned int rows, struct arguments args);
+uint8_t* convert_reduced_tiles(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int bitplane_count, struct tilemap* map, struct arguments args, unsigned int* data_size);
+uint8_t* convert_deduplicated_tiles(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int bitplane_count, struct tilemap* map, struct arguments args, unsigned int* data_size);
+uint8_t* generate_sprites(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int bitplane_count, struct arguments args, struct metasprite** metasprites, unsigned int* frame_count, unsigned int* data_size);
+void generate_tilemap(struct tilemap* map, struct arguments args);
+int add_shared_asset(struct tileset* set, struct arguments args, unsigned int* bit_depth);
+int convert_shared_tileset(struct arguments args);
+int convert_shared_palette(struct arguments args);
+int convert_single_file(struct arguments args);
 uint8_t* convert_to_tiles(uint8_t* data, unsigned int width, unsigned int height, unsigned int bitplane_count, unsigned int tilesize, unsigned int* data_size);
 
 int main(int argc, char *argv[])
+{
+  int exit_code;
+
+  //Parse command-line arguments
+  struct arguments args = parse_arguments(argc, argv);
+
+  if(args.trace_file && trace_open(args.trace_file) != 0)
+    return -1;
+
+  //Every binary output is written to the ROM, one after the other
+  if(args.patch_rom && rom_open(args.patch_rom, args.patch_protect, args.patch_checksum, args.verbose) != 0)
+  {
+    trace_close();
+    return -1;
+  }
+
+  //Convert every asset listed in the manifest
+  if(args.manifest_file)
+    exit_code = process_manifest(args, convert_file);
+  else
+    exit_code = convert_file(args);
+
+  if(rom_close() != 0)
+    exit_code = -1;
+
+  trace_close();
+
+  return exit_code;
+}
+
+int convert_file(struct arguments args)
+{
+  int exit_code;
+  uint64_t start = TRACE_BEGIN();
+
+  if(args.shared_tileset)
+    exit_code = convert_shared_tileset(args);
+  else if(args.shared_palette)
+    exit_code = convert_shared_palette(args);
+  else
+    exit_code = convert_single_file(args);
+
+  TRACE_END("convert", args.input_file, start);
+
+  return exit_code;
+}
+
+int convert_single_file(struct arguments args)
 {
   int exit_code = -2;
 
@@ -25,9 +111,6 @@ int main(int argc, char *argv[])
 
   FILE* input = NULL; //File containing png image
 
-  //Parse command-line arguments
-  struct arguments args = parse_arguments(argc, argv);
-
   //Open the file
   input = fopen(args.input_file, "rb");
   if (!input)
@@ -44,14 +127,66 @@ int main(int argc, char *argv[])
   if(!initialize_libpng(input, &png_ptr, &info_ptr, &end_info))
     goto close_file;
 
-  //If the PNG file does not contain a palette, exit
-  if(!detect_palette(png_ptr, info_ptr))
-    goto clean_png_struct;
+  //Mode 7 always uses 256 colors
+  if(args.mode7)
+    args.bitplanes = 8;
 
-  if (generate_cgram(png_ptr, info_ptr, args) != 0)
+  //OBJ characters are always 4bpp
+  if(args.sprite && args.bitplanes == 0)
+    args.bitplanes = 4;
+
+  //Nothing is written for options that cannot be used together
+  if(check_options(png_ptr, info_ptr, args) != 0)
     goto clean_png_struct;
 
-  generate_vram(png_ptr, info_ptr, args);
+  if(args.gradient)
+  {
+    if(!detect_palette(png_ptr, info_ptr) || convert_gradient(png_ptr, info_ptr, args) != 0)
+      goto clean_png_struct;
+  }
+  else if(args.split_layers)
+  {
+    if(!detect_palette(png_ptr, info_ptr) || convert_split_layers(png_ptr, info_ptr, args) != 0)
+      goto clean_png_struct;
+  }
+  else if(args.optimize_palette)
+  {
+    //The optimized palette depends on the pixels, the image is decoded first
+    if(!detect_palette(png_ptr, info_ptr) || convert_optimized(png_ptr, info_ptr, args) != 0)
+      goto clean_png_struct;
+  }
+  else if(args.mode7)
+  {
+    //Mode 7 can run out of characters, which is checked before writing anything
+    if(!detect_palette(png_ptr, info_ptr) || convert_mode7_image(png_ptr, info_ptr, args) != 0)
+      goto clean_png_struct;
+  }
+  else
+  {
+    //Direct color tiles do not use CGRAM
+    if(!args.direct_color)
+    {
+      //If the PNG file does not contain a palette, exit
+      if(!detect_palette(png_ptr, info_ptr))
+        goto clean_png_struct;
+
+      if (generate_cgram(png_ptr, info_ptr, args) != 0)
+        goto clean_png_struct;
+    }
+
+    if(args.region_count)
+    {
+      if(generate_regions(png_ptr, info_ptr, args) != 0)
+        goto clean_png_struct;
+    }
+    else if(args.emit_count)
+    {
+      if(generate_variants(png_ptr, info_ptr, args) != 0)
+        goto clean_png_struct;
+    }
+    else if(generate_vram(png_ptr, info_ptr, NULL, args) != 0)
+      goto clean_png_struct;
+  }
 
   exit_code++;
 clean_png_struct:
@@ -63,11 +198,225 @@ close_file:
   return exit_code;
 }
 
+//Reject option combinations generate_vram cannot output for this image
+int check_options(png_structp png_ptr, png_infop info_ptr, struct arguments args)
+{
+  unsigned int tilesize = args.tilesize ? args.tilesize : DEFAULT_TILE_SIZE;
+  unsigned int frame_width = args.frame_width ? args.frame_width : png_get_image_width(png_ptr, info_ptr);
+  unsigned int frame_height = args.frame_width ? args.frame_height : png_get_image_height(png_ptr, info_ptr);
+  unsigned int bitplane_count = args.bitplanes;
+
+  //Same bitplanes as generate_vram
+  if(args.direct_color)
+    bitplane_count = 8;
+  else if(bitplane_count == 0)
+    bitplane_count = png_get_bit_depth(png_ptr, info_ptr) < 2 ? 2 : png_get_bit_depth(png_ptr, info_ptr);
+
+  if(args.sprite && args.tilemap)
+  {
+    fprintf(stderr, "Sprites cannot be output with a BG map\n");
+    return -1;
+  }
+
+  if(args.sprite && args.direct_color)
+  {
+    fprintf(stderr, "OBJ characters cannot use direct color\n");
+    return -1;
+  }
+
+  if(args.sprite && args.bitplanes != 4)
+  {
+    fprintf(stderr, "OBJ characters are always 4bpp, %d bitplanes are not supported\n", args.bitplanes);
+    return -1;
+  }
+
+  //Metasprite offsets are single bytes
+  if(args.sprite && (frame_width > OBJ_MAX_FRAME_SIZE || frame_height > OBJ_MAX_FRAME_SIZE))
+  {
+    fprintf(stderr, "Frames of %ux%u are too large for metasprites (at most %ux%u, see --frame)\n", frame_width, frame_height, OBJ_MAX_FRAME_SIZE, OBJ_MAX_FRAME_SIZE);
+    return -1;
+  }
+
+  if(args.sprite && (frame_width > png_get_image_width(png_ptr, info_ptr) || frame_height > png_get_image_height(png_ptr, info_ptr)))
+  {
+    fprintf(stderr, "Frames of %ux%u do not fit in the image\n", frame_width, frame_height);
+    return -1;
+  }
+
+  for(int i = 0; i < args.region_count; i++)
+  {
+    struct region* region = &args.regions[i];
+
+    if(region->x + region->width > png_get_image_width(png_ptr, info_ptr) || region->y + region->height > png_get_image_height(png_ptr, info_ptr))
+    {
+      fprintf(stderr, "Region %d,%d,%d,%d is outside of the %ux%u image\n", region->x, region->y, region->width, region->height, png_get_image_width(png_ptr, info_ptr), png_get_image_height(png_ptr, info_ptr));
+      return -1;
+    }
+  }
+
+  if(args.emit_count && (args.direct_color || args.mode7 || args.sprite || args.max_tiles || args.dedup || args.superfx || args.bitmap || args.packed))
+  {
+    fprintf(stderr, "Variants only support plain tiles and BG maps\n");
+    return -1;
+  }
+
+  //Each variant writes its own palette, which must hold the image palette
+  for(int i = 0; i < args.emit_count; i++)
+  {
+    struct arguments variant_args = args;
+    png_color* png_palette;
+    int src_size = 0;
+
+    if(args.emits[i].bitplanes)
+      variant_args.bitplanes = args.emits[i].bitplanes;
+
+    png_get_PLTE(png_ptr, info_ptr, &png_palette, &src_size);
+
+    if(variant_args.bitplanes && src_size > cgram_size(png_ptr, info_ptr, variant_args))
+    {
+      fprintf(stderr, "More colors (%d) than %s can hold (%d)\n", src_size, args.emits[i].output_file, cgram_size(png_ptr, info_ptr, variant_args));
+      return -1;
+    }
+  }
+
+  if(args.mode7 && (args.tilemap || args.sprite))
+  {
+    fprintf(stderr, "Mode 7 output already contains its map\n");
+    return -1;
+  }
+
+  if(args.max_tiles && tilesize != 8)
+  {
+    fprintf(stderr, "Tile reduction only supports 8x8 tiles\n");
+    return -1;
+  }
+
+  if(args.dedup && (args.max_tiles || tilesize != 8))
+  {
+    fprintf(stderr, "Deduplication only supports 8x8 tiles without --max-tiles\n");
+    return -1;
+  }
+
+  if((args.superfx || args.bitmap) && (args.sprite || args.mode7 || args.max_tiles || args.dedup || tilesize != 8))
+  {
+    fprintf(stderr, "Super FX and bitmap layouts only support 8x8 tiles\n");
+    return -1;
+  }
+
+  if(args.bitmap && (args.tilemap || args.packed))
+  {
+    fprintf(stderr, "Bitmaps have no BG map and cannot be packed\n");
+    return -1;
+  }
+
+  if(args.packed && bitplane_count != 2 && bitplane_count != 4)
+  {
+    fprintf(stderr, "Only 2bpp and 4bpp tiles can be packed\n");
+    return -1;
+  }
+
+  //Every region is converted as its own image
+  if(!args.region_count)
+    return check_layout_size(png_get_image_width(png_ptr, info_ptr), png_get_image_height(png_ptr, info_ptr), bitplane_count, tilesize, args);
+
+  for(int i = 0; i < args.region_count; i++)
+  {
+    if(check_layout_size(args.regions[i].width, args.regions[i].height, bitplane_count, tilesize, args) != 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+//Reject images the Super FX screen, the bitmap rows or the BG map cannot hold
+int check_layout_size(unsigned int width, unsigned int height, unsigned int bitplane_count, unsigned int tilesize, struct arguments args)
+{
+  if(args.superfx && (width / 8 > SUPERFX_COLUMNS || height / 8 > args.superfx / 8))
+  {
+    fprintf(stderr, "Image is %ux%u tiles, Super FX screen only holds %ux%u\n", width / 8, height / 8, SUPERFX_COLUMNS, args.superfx / 8);
+    return -1;
+  }
+
+  if(args.bitmap && width % (8 / bitplane_count))
+  {
+    fprintf(stderr, "Bitmap width must be a multiple of %u pixels\n", 8 / bitplane_count);
+    return -1;
+  }
+
+  //Reduced, deduplicated and split tiles are counted once converted
+  if(!args.tilemap || args.max_tiles || args.dedup || args.split_layers)
+    return 0;
+
+  for(int i = -1; i < args.emit_count; i++)
+  {
+    unsigned int variant_tilesize = i >= 0 && args.emits[i].tilesize ? args.emits[i].tilesize : tilesize;
+    unsigned int last_character = last_map_character(width, height, variant_tilesize, args) + args.tile_offset;
+
+    if(last_character >= TILEMAP_MAX_TILES)
+    {
+      fprintf(stderr, "BG map uses characters up to %u, its entries can only address %u\n", last_character, TILEMAP_MAX_TILES);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+//Highest character addressed by the BG map of plain tiles, before the tile
+//offset. Cells clipped from the map do not count.
+unsigned int last_map_character(unsigned int width, unsigned int height, unsigned int tilesize, struct arguments args)
+{
+  unsigned int columns = width / tilesize, rows = height / tilesize;
+  unsigned int map_width = args.tilemap_width, map_height = args.tilemap_height;
+  unsigned int last_column, last_row;
+
+  if(columns == 0 || rows == 0)
+    return 0;
+
+  if(map_width == 0)
+    tilemap_fit(columns, rows, &map_width, &map_height);
+
+  last_column = (columns < map_width ? columns : map_width) - 1;
+  last_row = (rows < map_height ? rows : map_height) - 1;
+
+  //Super FX characters go down the columns of the screen
+  if(args.superfx)
+    return (last_column * (args.superfx / 8)) + last_row;
+
+  if(tilesize == 16)
+    return tile_16_16_character((last_row * columns) + last_column) + 17;
+
+  return (last_row * columns) + last_column;
+}
+
+//Number of colors written to CGRAM for the palette of the image
+int cgram_size(png_structp png_ptr, png_infop info_ptr, struct arguments args)
+{
+  int pad_to_size = powl(2, args.bitplanes);
+
+  //Tiles of a BG map and OBJs can use any of the 8 sub-palettes
+  if((args.tilemap || args.sprite) && args.bitplanes > 0 && args.bitplanes < 8)
+  {
+    png_color* png_palette;
+    int src_size = 0;
+
+    png_get_PLTE(png_ptr, info_ptr, &png_palette, &src_size);
+
+    if(src_size > pad_to_size)
+      pad_to_size *= src_size > pad_to_size * 8 ? 8 : (src_size + pad_to_size - 1) / pad_to_size;
+  }
+
+  return pad_to_size;
+}
+
 int generate_cgram(png_structp png_ptr, png_infop info_ptr, struct arguments args)
 {
   //Convert palette to the format used by the SNES
   int palette_size;
-  uint16_t* palette = convert_palette(png_ptr, info_ptr, &palette_size, powl(2, args.bitplanes));
+  uint64_t start = TRACE_BEGIN();
+  uint16_t* palette = convert_palette(png_ptr, info_ptr, &palette_size, cgram_size(png_ptr, info_ptr, args));
+
+  TRACE_END("palette", args.input_file, start);
 
   if (!palette)
 	  return -1;
@@ -78,75 +427,1313 @@ int generate_cgram(png_structp png_ptr, png_infop info_ptr, struct arguments arg
     fprintf(stderr, "CGRAM section is %d bytes long\n", palette_size * 2);
   }
 
+  start = TRACE_BEGIN();
+
   if(args.binary)
     output_palette_binary(args.output_file, palette, palette_size);
   else
     output_palette_wla(args.output_file, palette, palette_size);
 
+  TRACE_END("emit", args.input_file, start);
+
   free(palette);
 
   return 0;
 }
 
-void generate_vram(png_structp png_ptr, png_infop info_ptr, struct arguments args)
+//Merge and drop palette entries using the pixels of the image, then use the
+//fewest bitplanes that hold the remaining colors
+int convert_optimized(png_structp png_ptr, png_infop info_ptr, struct arguments args)
 {
-  unsigned int bitplane_count, tilesize, data_size;
-
-  //Get image size and bit depth
   unsigned int height = png_get_image_height(png_ptr, info_ptr);
   unsigned int width = png_get_image_width(png_ptr, info_ptr);
-  unsigned int bit_depth = png_get_bit_depth(png_ptr, info_ptr);
-  //unsigned int rowbytes = png_get_rowbytes(png_ptr, info_ptr);
+  unsigned int color_count, bitplane_count;
+  int exit_code;
+  uint16_t optimized[256];
+  uint8_t remap[256];
+  uint16_t* palette;
+  png_bytepp row_pointers;
+  uint64_t start;
 
-  //Print tilesize
-  if(args.tilesize == 0)
+  if(args.direct_color || args.region_count || args.emit_count)
   {
-    tilesize = DEFAULT_TILE_SIZE;
-    if(args.verbose)
-      fprintf(stderr, "Assuming %ux%u background tiles\n", tilesize, tilesize);
+    fprintf(stderr, "Palette optimization does not support direct color, regions or variants\n");
+    return -1;
+  }
+
+  start = TRACE_BEGIN();
+  row_pointers = read_png(png_ptr, info_ptr);
+  TRACE_END("decode", args.input_file, start);
+
+  start = TRACE_BEGIN();
+  palette = get_bgr15_palette(png_ptr, info_ptr);
+  color_count = optimize_palette(palette, row_pointers, width, height, remap, optimized);
+  TRACE_END("palette", args.input_file, start);
+
+  bitplane_count = color_count <= 4 ? 2 : (color_count <= 16 ? 4 : 8);
+
+  if(args.bitplanes == 0)
+    args.bitplanes = bitplane_count;
+
+  if(args.bitplanes < bitplane_count)
+  {
+    //Tiles then pick their sub-palette from the original indices
+    fprintf(stderr, "Image uses %u colors, keeping the sub-palettes of %d bitplanes\n", color_count, args.bitplanes);
+
+    if(generate_cgram(png_ptr, info_ptr, args) != 0)
+    {
+      free(palette);
+      free_png(row_pointers, height);
+      return -1;
+    }
   }
   else
   {
-    tilesize = args.tilesize;
+    start = TRACE_BEGIN();
+    remap_pixels(row_pointers, width, height, remap);
+    TRACE_END("transform", args.input_file, start);
+
     if(args.verbose)
-      fprintf(stderr, "Using %ux%u background tiles\n", tilesize, tilesize);
+    {
+      fprintf(stderr, "Image uses %u colors after merging, using %d bitplanes\n", color_count, args.bitplanes);
+      fprintf(stderr, "CGRAM section is %d bytes long\n", (1 << args.bitplanes) * 2);
+    }
+
+    start = TRACE_BEGIN();
+
+    if(args.binary)
+      output_palette_binary(args.output_file, optimized, 1 << args.bitplanes);
+    else
+      output_palette_wla(args.output_file, optimized, 1 << args.bitplanes);
+
+    TRACE_END("emit", args.input_file, start);
   }
 
-  //Print bitplanes used
-  if(args.bitplanes != 0)
+  exit_code = generate_vram(png_ptr, info_ptr, row_pointers, args);
+
+  free(palette);
+  free_png(row_pointers, height);
+
+  return exit_code;
+}
+
+//Split the tiles over a front and a back BG layer of 4bpp tiles, for images
+//using more than 16 colors in a tile. The tiles are split before the
+//palette is written, so nothing is written when a tile needs more than two
+//sub-palettes.
+int convert_split_layers(png_structp png_ptr, png_infop info_ptr, struct arguments args)
+{
+  unsigned int height = png_get_image_height(png_ptr, info_ptr);
+  unsigned int columns, rows, tile_count, conflicting;
+  int color_count = 0, exit_code = 0;
+  png_color* png_palette;
+  struct layer_split* splits;
+  uint8_t *tiles, *front, *back;
+  uint16_t* palette;
+  png_bytepp row_pointers;
+  uint64_t start;
+
+  if(args.direct_color || args.mode7 || args.sprite || args.max_tiles || args.region_count || args.emit_count || args.optimize_palette || args.superfx || args.bitmap || args.packed || args.tilesize == 16)
   {
-    bitplane_count = args.bitplanes;
-    if(args.verbose)
-      fprintf(stderr, "Using %u bitplanes\n", bitplane_count);
+    fprintf(stderr, "Layer splitting only supports plain 8x8 tiles and BG maps\n");
+    return -1;
+  }
+
+  if(args.bitplanes != 0 && args.bitplanes != 4)
+  {
+    fprintf(stderr, "Layers are split into 4bpp tiles, %d bitplanes are not supported\n", args.bitplanes);
+    return -1;
+  }
+
+  start = TRACE_BEGIN();
+  row_pointers = read_png(png_ptr, info_ptr);
+  TRACE_END("decode", args.input_file, start);
+
+  tiles = get_tiles_from_png(png_ptr, info_ptr, row_pointers, &columns, &rows);
+  free_png(row_pointers, height);
+
+  png_get_PLTE(png_ptr, info_ptr, &png_palette, &color_count);
+  palette = get_bgr15_palette(png_ptr, info_ptr);
+
+  tile_count = columns * rows;
+  front = malloc(tile_count * TILE_SIZE);
+  back = malloc(tile_count * TILE_SIZE);
+  splits = malloc(tile_count * sizeof(struct layer_split));
+
+  start = TRACE_BEGIN();
+  conflicting = split_layers(tiles, tile_count, palette, color_count, front, back, splits);
+  TRACE_END("transform", args.input_file, start);
+
+  if(conflicting)
+  {
+    for(unsigned int k = 0; k < tile_count; k++)
+    {
+      if(splits[k].conflicts)
+        fprintf(stderr, "Tile %u,%u needs more than two sub-palettes, %u pixels are left\n", k % columns, k / columns, splits[k].conflicts);
+    }
+
+    fprintf(stderr, "%u tiles cannot be split over two layers\n", conflicting);
+    exit_code = -1;
   }
   else
   {
-    //Get bit depth from png file
-    bitplane_count = bit_depth;
-    if(bitplane_count < 2)
-      bitplane_count = 2;
+    struct tilemap maps[2];
+    uint8_t* data[2];
+    unsigned int data_sizes[2];
 
-    if(args.verbose)
-      fprintf(stderr, "Assuming %u bitplanes\n", bitplane_count);
+    //Both layers must fit before anything is written
+    start = TRACE_BEGIN();
+    if(build_layer(front, splits, columns, rows, 0, &maps[0], &data[0], &data_sizes[0], args) != 0)
+      exit_code = -1;
+    else if(build_layer(back, splits, columns, rows, 1, &maps[1], &data[1], &data_sizes[1], args) != 0)
+    {
+      tilemap_free(&maps[0]);
+      free(data[0]);
+      exit_code = -1;
+    }
+    TRACE_END("tiles", args.input_file, start);
+
+    if(exit_code == 0)
+    {
+      //The palette holds the 8 sub-palettes both layers pick from
+      args.bitplanes = 4;
+      if(generate_cgram(png_ptr, info_ptr, args) != 0)
+        exit_code = -1;
+
+      start = TRACE_BEGIN();
+      if(exit_code == 0 && (generate_layer(&maps[0], data[0], data_sizes[0], 0, args) != 0 || generate_layer(&maps[1], data[1], data_sizes[1], 1, args) != 0))
+        exit_code = -1;
+      TRACE_END("emit", args.input_file, start);
+
+      for(size_t i = 0; i < 2; i++)
+      {
+        tilemap_free(&maps[i]);
+        free(data[i]);
+      }
+    }
   }
 
-  //Print information on the image
-  if(args.verbose)
+  free(splits);
+  free(back);
+  free(front);
+  free(palette);
+  free(tiles);
+
+  return exit_code;
+}
+
+//Deduplicate and convert the tiles of one layer and fill its BG map.
+//Nothing is kept when the BG map cannot address every tile.
+int build_layer(uint8_t* tiles, const struct layer_split* splits, unsigned int columns, unsigned int rows, int back, struct tilemap* map, uint8_t** data, unsigned int* data_size, struct arguments args)
+{
+  unsigned int index;
+  struct tileset set;
+  uint16_t flags;
+
+  init_tilemap(map, columns, rows, args);
+  tileset_init(&set);
+
+  for(size_t i = 0, k = 0; i < rows; i++)
   {
-    fprintf(stderr, "Image size is %ux%u, bit depth is %u\n", width / tilesize, height / tilesize, bit_depth);
-    fprintf(stderr, "Tile count: %u (%ux%u)\n", (width / tilesize) * (height / tilesize), width / tilesize, height / tilesize);
-    fprintf(stderr, "Outputting on %u bitplanes\n", bitplane_count);
+    for(size_t j = 0; j < columns; j++, k++)
+    {
+      index = add_tile(&set, tiles + (k * TILE_SIZE), 4, args.dedup, &flags);
+      tilemap_set(map, j, i, index, back ? splits[k].back_palette : splits[k].front_palette, flags);
+    }
   }
 
-  uint8_t* data = convert_tiles(png_ptr, info_ptr, bitplane_count, tilesize, &data_size);
+  //The BG map would wrap to other tiles
+  if(set.count + args.tile_offset > TILEMAP_MAX_TILES)
+  {
+    fprintf(stderr, "%s layer holds %u tiles from tile %u, BG map entries can only address %u\n", back ? "Back" : "Front", set.count, args.tile_offset, TILEMAP_MAX_TILES);
+    tilemap_free(map);
+    tileset_free(&set);
+    return -1;
+  }
+
+  *data = convert_tileset(&set, 4, data_size);
 
   if(args.verbose)
-    fprintf(stderr, "VRAM section is %u bytes long\n", data_size);
+    fprintf(stderr, "%s layer: %u unique tiles, VRAM section is %u bytes long\n", back ? "Back" : "Front", set.count, *data_size);
+
+  tileset_free(&set);
+
+  return 0;
+}
+
+//Output the tiles and the BG map of one layer to BASENAME_front or
+//BASENAME_back
+int generate_layer(struct tilemap* map, uint8_t* data, unsigned int data_size, int back, struct arguments args)
+{
+  char* basename;
+
+  if(strcmp(args.output_file, "-") == 0)
+    basename = strdup(args.output_file);
+  else if(asprintf(&basename, "%s_%s", args.output_file, back ? "back" : "front") == -1)
+  {
+    perror("generate_layer");
+    return -1;
+  }
+
+  args.output_file = basename;
 
   if(args.binary)
     output_tiles_binary(args.output_file, data, data_size);
   else
     output_tiles_wla(args.output_file, data, data_size);
 
-  free(data);
+  generate_tilemap(map, args);
+
+  free(basename);
+
+  return 0;
 }
+
+//Convert the image, or every region, to Mode 7 before writing the palette,
+//so that nothing is written when one of them has too many characters
+int convert_mode7_image(png_structp png_ptr, png_infop info_ptr, struct arguments args)
+{
+  unsigned int height = png_get_image_height(png_ptr, info_ptr);
+  unsigned int width = png_get_image_width(png_ptr, info_ptr);
+  unsigned int pixel_bytes = png_get_rowbytes(png_ptr, info_ptr) / width;
+  unsigned int count = args.region_count ? args.region_count : 1;
+  unsigned int tile_count;
+  unsigned int* data_sizes;
+  uint8_t** data;
+  png_bytepp row_pointers;
+  uint64_t start;
+  int exit_code = 0;
+
+  start = TRACE_BEGIN();
+  row_pointers = read_png(png_ptr, info_ptr);
+  TRACE_END("decode", args.input_file, start);
+
+  data = calloc(count, sizeof(uint8_t*));
+  data_sizes = calloc(count, sizeof(unsigned int));
+
+  start = TRACE_BEGIN();
+
+  for(unsigned int i = 0; i < count && exit_code == 0; i++)
+  {
+    png_bytepp rows = row_pointers;
+
+    if(args.region_count)
+    {
+      struct region* region = &args.regions[i];
+
+      rows = malloc(region->height * sizeof(png_bytep));
+      for(size_t y = 0; y < region->height; y++)
+        rows[y] = row_pointers[region->y + y] + (region->x * pixel_bytes);
+
+      set_png_size(png_ptr, info_ptr, region->width, region->height);
+    }
+
+    data[i] = convert_mode7(png_ptr, info_ptr, rows, &tile_count, &data_sizes[i]);
+
+    if(!data[i])
+      exit_code = -1;
+    else if(args.verbose)
+      fprintf(stderr, "Mode 7 map uses %u unique characters\n", tile_count);
+
+    if(args.region_count)
+    {
+      set_png_size(png_ptr, info_ptr, width, height);
+      free(rows);
+    }
+  }
+
+  TRACE_END("tiles", args.input_file, start);
+
+  if(exit_code == 0 && generate_cgram(png_ptr, info_ptr, args) != 0)
+    exit_code = -1;
+
+  if(exit_code == 0)
+  {
+    start = TRACE_BEGIN();
+
+    for(unsigned int i = 0; i < count; i++)
+    {
+      char* basename = region_basename(args.output_file, i, args.region_count);
+
+      if(args.verbose)
+        fprintf(stderr, "VRAM section is %u bytes long\n", data_sizes[i]);
+
+      if(args.binary)
+        output_tiles_binary(basename, data[i], data_sizes[i]);
+      else
+        output_tiles_wla(basename, data[i], data_sizes[i]);
+
+      free(basename);
+    }
+
+    TRACE_END("emit", args.input_file, start);
+  }
+
+  for(unsigned int i = 0; i < count; i++)
+    free(data[i]);
+
+  free(data_sizes);
+  free(data);
+  free_png(row_pointers, height);
+
+  return exit_code;
+}
+
+//Go down the image one band of tiles at a time, keeping the colors of each
+//scanline in the slots of a sub-palette. Colors that do not fit the base
+//palette are rewritten by HDMA before the lines that use them.
+int convert_gradient(png_structp png_ptr, png_infop info_ptr, struct arguments args)
+{
+  unsigned int height = png_get_image_height(png_ptr, info_ptr);
+  unsigned int width = png_get_image_width(png_ptr, info_ptr);
+  unsigned int rowbytes = png_get_rowbytes(png_ptr, info_ptr);
+  unsigned int bitplane_count = args.bitplanes ? args.bitplanes : 4;
+  unsigned int columns = width / 8, bands = height / GRADIENT_BAND_HEIGHT;
+  unsigned int bytes_per_tile = 8 * bitplane_count, data_size, table_size;
+  png_bytep band[GRADIENT_BAND_HEIGHT];
+  uint8_t tile[TILE_SIZE];
+  uint8_t *data, *tables;
+  uint16_t* palette;
+  struct gradient gradient;
+  struct tilemap map;
+  uint64_t start;
+  int exit_code = 0;
+
+  if(args.direct_color || args.mode7 || args.sprite || args.max_tiles || args.dedup || args.split_layers || args.region_count || args.emit_count || args.optimize_palette || args.tilesize == 16)
+  {
+    fprintf(stderr, "Gradients only support plain 8x8 tiles and BG maps\n");
+    return -1;
+  }
+
+  if(png_get_interlace_type(png_ptr, info_ptr) != PNG_INTERLACE_NONE)
+  {
+    fprintf(stderr, "Gradients need images that are not interlaced\n");
+    return -1;
+  }
+
+  palette = get_bgr15_palette(png_ptr, info_ptr);
+  gradient_init(&gradient, bitplane_count, args.gradient);
+
+  data_size = columns * bands * bytes_per_tile;
+  data = malloc(data_size);
+
+  if(args.tilemap)
+    init_tilemap(&map, columns, bands, args);
+
+  for(size_t i = 0; i < GRADIENT_BAND_HEIGHT; i++)
+    band[i] = malloc(rowbytes);
+
+  //Only one band of rows is held in memory
+  for(size_t i = 0, k = 0; i < bands; i++)
+  {
+    start = TRACE_BEGIN();
+    png_read_rows(png_ptr, band, NULL, GRADIENT_BAND_HEIGHT);
+    TRACE_END("decode", args.input_file, start);
+
+    start = TRACE_BEGIN();
+    gradient_add_band(&gradient, band, width, GRADIENT_BAND_HEIGHT, palette);
+    TRACE_END("palette", args.input_file, start);
+
+    start = TRACE_BEGIN();
+    for(size_t j = 0; j < columns; j++, k++)
+    {
+      get_tile_from_png(tile, png_ptr, band, j, 0);
+      convert_to_bitplanes(data + (k * bytes_per_tile), tile, bitplane_count);
+
+      if(args.tilemap)
+        tilemap_set(&map, j, i, k, 0, 0);
+    }
+    TRACE_END("tiles", args.input_file, start);
+  }
+
+  for(size_t i = 0; i < GRADIENT_BAND_HEIGHT; i++)
+    free(band[i]);
+
+  if(gradient.conflicts)
+  {
+    fprintf(stderr, "%u lines do not fit in %u colors with %d CGRAM writes per line\n", gradient.conflicts, gradient.slot_size - 1, args.gradient);
+    exit_code = -1;
+    goto free_gradient;
+  }
+
+  tables = gradient_hdma_tables(&gradient, &table_size);
+
+  if(args.verbose)
+  {
+    fprintf(stderr, "%u CGRAM writes over %u lines, HDMA tables are %u bytes long\n", gradient.write_count, gradient.line, table_size);
+    fprintf(stderr, "VRAM section is %u bytes long\n", data_size);
+  }
+
+  start = TRACE_BEGIN();
+
+  if(args.binary)
+  {
+    output_palette_binary(args.output_file, gradient.base, gradient.slot_size);
+    output_tiles_binary(args.output_file, data, data_size);
+  }
+  else
+  {
+    output_palette_wla(args.output_file, gradient.base, gradient.slot_size);
+    output_tiles_wla(args.output_file, data, data_size);
+  }
+
+  if(args.tilemap)
+    generate_tilemap(&map, args);
+
+  if(args.binary)
+    output_hdma_binary(args.output_file, tables, table_size);
+  else
+    output_hdma_wla(args.output_file, tables, table_size);
+
+  TRACE_END("emit", args.input_file, start);
+
+  free(tables);
+
+free_gradient:
+  if(args.tilemap)
+    tilemap_free(&map);
+
+  free(data);
+  free(palette);
+  gradient_free(&gradient);
+
+  return exit_code;
+}
+
+//Rows already decoded by the caller are left to it, NULL decodes them here
+int generate_vram(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, struct arguments args)
+{
+  unsigned int bitplane_count, tilesize, data_size;
+  int decoded = row_pointers == NULL;
+  struct tilemap map;
+  struct metasprite* metasprites = NULL;
+  unsigned int frame_count = 0;
+  uint8_t* palettes = NULL;
+  uint64_t start;
+
+  //Get image size and bit depth
+  unsigned int height = png_get_image_height(png_ptr, info_ptr);
+  unsigned int width = png_get_image_width(png_ptr, info_ptr);
+  unsigned int bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+  //unsigned int rowbytes = png_get_rowbytes(png_ptr, info_ptr);
+
+  //Print tilesize
+  if(args.tilesize == 0)
+  {
+    tilesize = DEFAULT_TILE_SIZE;
+    if(args.verbose)
+      fprintf(stderr, "Assuming %ux%u background tiles\n", tilesize, tilesize);
+  }
+  else
+  {
+    tilesize = args.tilesize;
+    if(args.verbose)
+      fprintf(stderr, "Using %ux%u background tiles\n", tilesize, tilesize);
+  }
+
+  //Print bitplanes used
+  if(args.direct_color)
+  {
+    bitplane_count = 8;
+    if(args.verbose)
+      fprintf(stderr, "Using 8 bitplanes in direct color mode\n");
+
+    if(args.bitplanes != 0 && args.bitplanes != 8)
+      fprintf(stderr, "Direct color mode ignores %d bitplanes\n", args.bitplanes);
+  }
+  else if(args.bitplanes != 0)
+  {
+    bitplane_count = args.bitplanes;
+    if(args.verbose)
+      fprintf(stderr, "Using %u bitplanes\n", bitplane_count);
+  }
+  else
+  {
+    //Get bit depth from png file
+    bitplane_count = bit_depth;
+    if(bitplane_count < 2)
+      bitplane_count = 2;
+
+    if(args.verbose)
+      fprintf(stderr, "Assuming %u bitplanes\n", bitplane_count);
+  }
+
+  //Print information on the image
+  if(args.verbose)
+  {
+    fprintf(stderr, "Image size is %ux%u, bit depth is %u\n", width / tilesize, height / tilesize, bit_depth);
+    fprintf(stderr, "Tile count: %u (%ux%u)\n", (width / tilesize) * (height / tilesize), width / tilesize, height / tilesize);
+    fprintf(stderr, "Outputting on %u bitplanes\n", bitplane_count);
+  }
+
+  if(args.tilemap)
+    init_tilemap(&map, width / tilesize, height / tilesize, args);
+
+  if(decoded)
+  {
+    start = TRACE_BEGIN();
+    row_pointers = read_png(png_ptr, info_ptr);
+    TRACE_END("decode", args.input_file, start);
+  }
+
+  //Palette bits of the BG map extend the direct colors of each tile
+  if(args.direct_color)
+  {
+    start = TRACE_BEGIN();
+    palettes = convert_to_direct_color(png_ptr, info_ptr, row_pointers, tilesize, args.tilemap);
+    TRACE_END("transform", args.input_file, start);
+  }
+
+  uint8_t* data;
+
+  start = TRACE_BEGIN();
+
+  if(args.sprite)
+    data = generate_sprites(png_ptr, info_ptr, row_pointers, bitplane_count, args, &metasprites, &frame_count, &data_size);
+  else if(args.max_tiles)
+    data = convert_reduced_tiles(png_ptr, info_ptr, row_pointers, bitplane_count, &map, args, &data_size);
+  else if(args.dedup)
+    data = convert_deduplicated_tiles(png_ptr, info_ptr, row_pointers, bitplane_count, &map, args, &data_size);
+  else if(args.superfx)
+  {
+    unsigned int columns, rows;
+    uint8_t* tiles = get_tiles_from_png(png_ptr, info_ptr, row_pointers, &columns, &rows);
+
+    data = convert_superfx(tiles, columns, rows, bitplane_count, args.superfx, args.tilemap ? &map : NULL, &data_size);
+    free(tiles);
+  }
+  else if(args.bitmap)
+    data = convert_linear_bitmap(row_pointers, width, height, bitplane_count, &data_size);
+  else
+    data = convert_tiles(png_ptr, info_ptr, row_pointers, bitplane_count, tilesize, args.tilemap ? &map : NULL, &data_size);
+
+  TRACE_END("tiles", args.input_file, start);
+
+  if(decoded)
+    free_png(row_pointers, height);
+
+  if(!data)
+  {
+    if(args.tilemap)
+      tilemap_free(&map);
+
+    free(palettes);
+    return -1;
+  }
+
+  if(args.packed)
+  {
+    data_size = pack_tiles(data, data_size, bitplane_count);
+
+    if(!data_size)
+    {
+      if(args.tilemap)
+        tilemap_free(&map);
+
+      if(metasprites)
+        free_metasprites(metasprites, frame_count);
+
+      free(palettes);
+      free(data);
+      return -1;
+    }
+  }
+
+  if(args.verbose)
+    fprintf(stderr, "VRAM section is %u bytes long\n", data_size);
+
+  start = TRACE_BEGIN();
+
+  //Characters, then the BG map, then the metasprites
+  if(args.binary)
+    output_tiles_binary(args.output_file, data, data_size);
+  else
+    output_tiles_wla(args.output_file, data, data_size);
+
+  if(args.tilemap)
+  {
+    if(palettes)
+    {
+      for(size_t i = 0, k = 0; i < height / tilesize; i++)
+      {
+        for(size_t j = 0; j < width / tilesize; j++, k++)
+          tilemap_set_palette(&map, j, i, palettes[k]);
+      }
+    }
+
+    generate_tilemap(&map, args);
+    tilemap_free(&map);
+  }
+
+  if(metasprites)
+  {
+    if(args.binary)
+      output_metasprites_binary(args.output_file, metasprites, frame_count);
+    else
+      output_metasprites_wla(args.output_file, metasprites, frame_count);
+
+    free_metasprites(metasprites, frame_count);
+  }
+
+  TRACE_END("emit", args.input_file, start);
+
+  free(palettes);
+  free(data);
+
+  return 0;
+}
+
+//Convert every region as its own image, decoding the rows they need once.
+//Regions are checked to be inside the image by check_options.
+int generate_regions(png_structp png_ptr, png_infop info_ptr, struct arguments args)
+{
+  unsigned int height = png_get_image_height(png_ptr, info_ptr);
+  unsigned int width = png_get_image_width(png_ptr, info_ptr);
+  unsigned int pixel_bytes = png_get_rowbytes(png_ptr, info_ptr) / width;
+  unsigned int row_count = 0;
+  png_bytepp row_pointers;
+  uint64_t start;
+  int exit_code = 0;
+
+  for(int i = 0; i < args.region_count; i++)
+  {
+    struct region* region = &args.regions[i];
+
+    if(region->y + region->height > row_count)
+      row_count = region->y + region->height;
+  }
+
+  if(args.verbose)
+    fprintf(stderr, "Decoding %u of %u rows for %d regions\n", row_count, height, args.region_count);
+
+  start = TRACE_BEGIN();
+  row_pointers = read_png_rows(png_ptr, info_ptr, row_count);
+  TRACE_END("decode", args.input_file, start);
+
+  for(int i = 0; i < args.region_count; i++)
+  {
+    struct region* region = &args.regions[i];
+    struct arguments region_args = args;
+    png_bytepp region_rows = malloc(region->height * sizeof(png_bytep));
+
+    region_args.output_file = region_basename(args.output_file, i, args.region_count);
+
+    for(size_t y = 0; y < region->height; y++)
+    {
+      region_rows[y] = row_pointers[region->y + y] + (region->x * pixel_bytes);
+
+      //Direct color rewrites pixels in place, overlapping regions need their own copy
+      if(args.direct_color)
+      {
+        png_bytep row = malloc(region->width * pixel_bytes);
+        memcpy(row, region_rows[y], region->width * pixel_bytes);
+        region_rows[y] = row;
+      }
+    }
+
+    set_png_size(png_ptr, info_ptr, region->width, region->height);
+    if(generate_vram(png_ptr, info_ptr, region_rows, region_args) != 0)
+      exit_code = -1;
+
+    if(args.direct_color)
+    {
+      for(size_t y = 0; y < region->height; y++)
+        free(region_rows[y]);
+    }
+
+    free(region_rows);
+    free(region_args.output_file);
+  }
+
+  set_png_size(png_ptr, info_ptr, width, height);
+  free_png(row_pointers, row_count);
+
+  return exit_code;
+}
+
+//Output the main tiles and every --emit variant from a single decode. The
+//chunky tiles are extracted once and shared by every conversion. The
+//options are checked by check_options.
+int generate_variants(png_structp png_ptr, png_infop info_ptr, struct arguments args)
+{
+  unsigned int height = png_get_image_height(png_ptr, info_ptr);
+  unsigned int bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+  unsigned int columns, rows;
+  png_bytepp row_pointers;
+  uint8_t* tiles;
+  uint64_t start;
+  int exit_code = 0;
+
+  start = TRACE_BEGIN();
+  row_pointers = read_png(png_ptr, info_ptr);
+  TRACE_END("decode", args.input_file, start);
+
+  start = TRACE_BEGIN();
+  tiles = get_tiles_from_png(png_ptr, info_ptr, row_pointers, &columns, &rows);
+  TRACE_END("transform", args.input_file, start);
+
+  free_png(row_pointers, height);
+
+  //The main output comes first, its palette is already written
+  for(int i = -1; i < args.emit_count; i++)
+  {
+    struct arguments variant_args = args;
+    unsigned int bitplane_count, tilesize, data_size;
+    struct tilemap map;
+    uint8_t* data;
+
+    if(i >= 0)
+    {
+      if(args.emits[i].bitplanes)
+        variant_args.bitplanes = args.emits[i].bitplanes;
+      if(args.emits[i].tilesize)
+        variant_args.tilesize = args.emits[i].tilesize;
+      variant_args.output_file = args.emits[i].output_file;
+
+      if(generate_cgram(png_ptr, info_ptr, variant_args) != 0)
+      {
+        exit_code = -1;
+        continue;
+      }
+    }
+
+    bitplane_count = variant_args.bitplanes;
+    if(bitplane_count == 0)
+      bitplane_count = bit_depth < 2 ? 2 : bit_depth;
+
+    tilesize = variant_args.tilesize ? variant_args.tilesize : DEFAULT_TILE_SIZE;
+
+    if(args.verbose)
+      fprintf(stderr, "%s: %ux%u tiles on %u bitplanes\n", variant_args.output_file, tilesize, tilesize, bitplane_count);
+
+    if(args.tilemap)
+      init_tilemap(&map, columns * 8 / tilesize, rows * 8 / tilesize, variant_args);
+
+    start = TRACE_BEGIN();
+    data = convert_chunky_tiles(tiles, columns, rows, bitplane_count, tilesize, args.tilemap ? &map : NULL, &data_size);
+    TRACE_END("tiles", variant_args.output_file, start);
+
+    if(!data)
+    {
+      if(args.tilemap)
+        tilemap_free(&map);
+
+      exit_code = -1;
+      continue;
+    }
+
+    if(args.verbose)
+      fprintf(stderr, "VRAM section is %u bytes long\n", data_size);
+
+    start = TRACE_BEGIN();
+
+    if(args.binary)
+      output_tiles_binary(variant_args.output_file, data, data_size);
+    else
+      output_tiles_wla(variant_args.output_file, data, data_size);
+
+    if(args.tilemap)
+    {
+      generate_tilemap(&map, variant_args);
+      tilemap_free(&map);
+    }
+
+    TRACE_END("emit", variant_args.output_file, start);
+
+    free(data);
+  }
+
+  free(tiles);
+
+  return exit_code;
+}
+
+int add_shared_asset(struct tileset* set, struct arguments args, unsigned int* bit_depth)
+{
+  int exit_code = -1;
+  unsigned int tile_count, last_tile = 0;
+  uint32_t* remap;
+  struct tilemap map;
+  png_bytepp row_pointers;
+  uint64_t start;
+
+  //Lib PNG Structures
+  png_structp png_ptr;
+  png_infop info_ptr, end_info;
+
+  FILE* input = fopen(args.input_file, "rb");
+  if (!input)
+  {
+    fprintf(stderr, "Error opening file %s\n", args.input_file);
+    return -1;
+  }
+
+  if (!detect_png(input) || !initialize_libpng(input, &png_ptr, &info_ptr, &end_info))
+  {
+    fclose(input);
+    return -1;
+  }
+
+  if (!detect_palette(png_ptr, info_ptr) || generate_cgram(png_ptr, info_ptr, args) != 0)
+    goto clean_png_struct;
+
+  if (png_get_bit_depth(png_ptr, info_ptr) > *bit_depth)
+    *bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+
+  init_tilemap(&map, png_get_image_width(png_ptr, info_ptr) / 8, png_get_image_height(png_ptr, info_ptr) / 8, args);
+
+  start = TRACE_BEGIN();
+  row_pointers = read_png(png_ptr, info_ptr);
+  TRACE_END("decode", args.input_file, start);
+
+  //Palette numbers are only known when the bitplanes are given
+  start = TRACE_BEGIN();
+  remap = add_tiles_to_tileset(set, png_ptr, info_ptr, row_pointers, args.bitplanes ? args.bitplanes : 8, args.dedup, &map, &tile_count);
+  TRACE_END("tiles", args.input_file, start);
+
+  free_png(row_pointers, png_get_image_height(png_ptr, info_ptr));
+
+  if(args.verbose)
+    fprintf(stderr, "%s: %u tiles, shared tileset now holds %u tiles\n", args.input_file, tile_count, set->count);
+
+  for(unsigned int i = 0; i < tile_count; i++)
+  {
+    if(remap[i] > last_tile)
+      last_tile = remap[i];
+  }
+
+  //BG map entries cannot address tiles past the 1024 characters of a BG
+  if(last_tile + args.tile_offset >= TILEMAP_MAX_TILES && args.tilemap)
+  {
+    fprintf(stderr, "%s uses shared tile %u, BG map entries can only address %u tiles\n", args.input_file, last_tile + args.tile_offset, TILEMAP_MAX_TILES);
+    goto free_remap;
+  }
+
+  //Remap table holds the full shared tile index of each tile of the asset
+  start = TRACE_BEGIN();
+
+  if(last_tile + args.tile_offset < TILEMAP_MAX_TILES)
+    generate_tilemap(&map, args);
+  else if(args.verbose)
+    fprintf(stderr, "%s uses tiles past the BG map range, only its remap table is written\n", args.input_file);
+
+  if(args.binary)
+    output_dwords_binary(args.output_file, ".rmp", remap, tile_count);
+  else
+    output_dwords_wla(args.output_file, "_remap.asm", remap, tile_count);
+
+  TRACE_END("emit", args.input_file, start);
+
+  exit_code = 0;
+
+free_remap:
+  free(remap);
+  tilemap_free(&map);
+
+clean_png_struct:
+  png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+  fclose(input);
+
+  return exit_code;
+}
+
+int convert_shared_tileset(struct arguments args)
+{
+  int exit_code = 0;
+  unsigned int bitplane_count, bit_depth = 0, data_size;
+  struct tileset set;
+  uint8_t* data;
+  uint64_t start;
+
+  if(args.tilesize == 16)
+  {
+    fprintf(stderr, "Shared tilesets only support 8x8 tiles\n");
+    return -1;
+  }
+
+  tileset_init(&set);
+
+  //Every asset is written next to its input, the tileset uses the output basename
+  for(int i = 0; i < args.input_count; i++)
+  {
+    struct arguments asset_args = args;
+    char* basename = strip_png_extension(args.input_files[i]);
+
+    asset_args.input_file = args.input_files[i];
+    asset_args.output_file = basename;
+
+    if(add_shared_asset(&set, asset_args, &bit_depth) != 0)
+      exit_code = -1;
+
+    free(basename);
+  }
+
+  bitplane_count = args.bitplanes;
+  if(bitplane_count == 0)
+    bitplane_count = bit_depth < 2 ? 2 : bit_depth;
+
+  start = TRACE_BEGIN();
+  data = convert_tileset(&set, bitplane_count, &data_size);
+  TRACE_END("tiles", args.output_file, start);
+
+  if(args.verbose)
+  {
+    fprintf(stderr, "Shared tileset contains %u unique tiles on %u bitplanes\n", set.count, bitplane_count);
+    fprintf(stderr, "VRAM section is %u bytes long\n", data_size);
+  }
+
+  if(args.binary)
+    output_tiles_binary(args.output_file, data, data_size);
+  else
+    output_tiles_wla(args.output_file, data, data_size);
+
+  free(data);
+  tileset_free(&set);
+
+  return exit_code;
+}
+
+struct palette_asset
+{
+  FILE* input;
+  png_structp png_ptr;
+  png_infop info_ptr, end_info;
+  png_bytepp row_pointers;
+  char* input_file;
+  unsigned int first_subpalette, subpalette_count;
+};
+
+int open_palette_asset(struct palette_asset* asset, char* input_file)
+{
+  asset->input_file = input_file;
+  asset->input = fopen(input_file, "rb");
+  if (!asset->input)
+  {
+    fprintf(stderr, "Error opening file %s\n", input_file);
+    return -1;
+  }
+
+  if (!detect_png(asset->input) || !initialize_libpng(asset->input, &asset->png_ptr, &asset->info_ptr, &asset->end_info))
+  {
+    fclose(asset->input);
+    return -1;
+  }
+
+  if (!detect_palette(asset->png_ptr, asset->info_ptr))
+  {
+    png_destroy_read_struct(&asset->png_ptr, &asset->info_ptr, &asset->end_info);
+    fclose(asset->input);
+    return -1;
+  }
+
+  return 0;
+}
+
+int convert_shared_palette(struct arguments args)
+{
+  int exit_code = 0;
+  unsigned int bitplane_count = args.bitplanes ? args.bitplanes : 4;
+  unsigned int slot_size = 1 << bitplane_count, slot_count, asset_count = 0, subpalette_count = 0;
+  struct palette_asset* assets = malloc(args.input_count * sizeof(struct palette_asset));
+  struct subpalette* subpalettes = malloc(args.input_count * (CGRAM_COLORS / slot_size) * sizeof(struct subpalette));
+  uint16_t cgram[CGRAM_COLORS], backdrop = 0;
+  uint64_t start;
+
+  if(args.direct_color || args.mode7)
+  {
+    fprintf(stderr, "Shared palettes need indexed tiles\n");
+    exit_code = -1;
+    goto free_assets;
+  }
+
+  //Every asset stays decoded until the palettes of all of them are packed
+  for(int i = 0; i < args.input_count; i++)
+  {
+    struct palette_asset* asset = &assets[asset_count];
+    uint16_t* palette;
+
+    if(open_palette_asset(asset, args.input_files[i]) != 0)
+    {
+      exit_code = -1;
+      continue;
+    }
+
+    if(check_options(asset->png_ptr, asset->info_ptr, args) != 0)
+    {
+      png_destroy_read_struct(&asset->png_ptr, &asset->info_ptr, &asset->end_info);
+      fclose(asset->input);
+      exit_code = -1;
+      continue;
+    }
+
+    start = TRACE_BEGIN();
+    asset->row_pointers = read_png(asset->png_ptr, asset->info_ptr);
+    TRACE_END("decode", args.input_files[i], start);
+
+    start = TRACE_BEGIN();
+    palette = get_bgr15_palette(asset->png_ptr, asset->info_ptr);
+    asset->first_subpalette = subpalette_count;
+    asset->subpalette_count = collect_subpalettes(asset->row_pointers, png_get_image_width(asset->png_ptr, asset->info_ptr), png_get_image_height(asset->png_ptr, asset->info_ptr), palette, bitplane_count, i, subpalettes + subpalette_count);
+    subpalette_count += asset->subpalette_count;
+    TRACE_END("palette", args.input_files[i], start);
+
+    //The backdrop color comes from the first asset
+    if(asset_count == 0)
+      backdrop = palette[0];
+
+    free(palette);
+    asset_count++;
+  }
+
+  //Nothing is written unless every asset can be converted
+  if(exit_code != 0)
+    goto free_assets;
+
+  start = TRACE_BEGIN();
+
+  if(pack_subpalettes(subpalettes, subpalette_count, bitplane_count, cgram, &slot_count) != 0)
+  {
+    exit_code = -1;
+    goto free_assets;
+  }
+
+  cgram[0] = backdrop;
+
+  TRACE_END("palette", args.output_file, start);
+
+  if(args.verbose)
+  {
+    fprintf(stderr, "%u sub-palettes packed into %u slots of %u colors\n", subpalette_count, slot_count, slot_size);
+    fprintf(stderr, "CGRAM section is %u bytes long\n", slot_count * slot_size * 2);
+  }
+
+  if(args.binary)
+    output_palette_binary(args.output_file, cgram, slot_count * slot_size);
+  else
+    output_palette_wla(args.output_file, cgram, slot_count * slot_size);
+
+  //Every asset is written next to its input, the palette uses the output basename
+  for(unsigned int i = 0; i < asset_count; i++)
+  {
+    struct palette_asset* asset = &assets[i];
+    struct subpalette* first = subpalettes + asset->first_subpalette;
+    struct arguments asset_args = args;
+    char* basename = strip_png_extension(asset->input_file);
+    uint16_t numbers[CGRAM_COLORS] = { 0 };
+    unsigned int number_count = 0;
+
+    asset_args.input_file = asset->input_file;
+    asset_args.output_file = basename;
+    asset_args.bitplanes = bitplane_count;
+
+    start = TRACE_BEGIN();
+    remap_to_slots(asset->row_pointers, png_get_image_width(asset->png_ptr, asset->info_ptr), png_get_image_height(asset->png_ptr, asset->info_ptr), first, asset->subpalette_count, bitplane_count);
+    TRACE_END("transform", asset_args.input_file, start);
+
+    //CGRAM slot of each sub-palette of the asset
+    for(unsigned int j = 0; j < asset->subpalette_count; j++)
+    {
+      numbers[first[j].number] = first[j].slot;
+      if(first[j].number >= number_count)
+        number_count = first[j].number + 1;
+    }
+
+    if(generate_vram(asset->png_ptr, asset->info_ptr, asset->row_pointers, asset_args) != 0)
+    {
+      exit_code = -1;
+      free(basename);
+      continue;
+    }
+
+    if(args.binary)
+      output_words_binary(basename, ".pal", numbers, number_count);
+    else
+      output_words_wla(basename, "_palettes.asm", numbers, number_count);
+
+    free(basename);
+  }
+
+free_assets:
+  for(unsigned int i = 0; i < asset_count; i++)
+  {
+    free_png(assets[i].row_pointers, png_get_image_height(assets[i].png_ptr, assets[i].info_ptr));
+    png_destroy_read_struct(&assets[i].png_ptr, &assets[i].info_ptr, &assets[i].end_info);
+    fclose(assets[i].input);
+  }
+
+  free(subpalettes);
+  free(assets);
+
+  return exit_code;
+}
+
+void init_tilemap(struct tilemap* map, unsigned int columns, unsigned int rows, struct arguments args)
+{
+  unsigned int width = args.tilemap_width, height = args.tilemap_height;
+
+  if(width == 0)
+    tilemap_fit(columns, rows, &width, &height);
+
+  if(columns > width || rows > height)
+    fprintf(stderr, "Image is %ux%u tiles, BG map is clipped to %ux%u\n", columns, rows, width, height);
+
+  tilemap_init(map, width, height, args.tile_offset, args.priority);
+}
+
+void generate_tilemap(struct tilemap* map, struct arguments args)
+{
+  if(args.verbose)
+    fprintf(stderr, "BG map is %ux%u, %u bytes long\n", map->width, map->height, tilemap_size(map) * 2);
+
+  if(args.binary)
+    output_words_binary(args.output_file, ".map", map->entries, tilemap_size(map));
+  else
+    output_words_wla(args.output_file, "_map.asm", map->entries, tilemap_size(map));
+}
+
+uint8_t* convert_reduced_tiles(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int bitplane_count, struct tilemap* map, struct arguments args, unsigned int* data_size)
+{
+  unsigned int columns = png_get_image_width(png_ptr, info_ptr) / 8;
+  unsigned int tile_count, unique_count;
+  unsigned int *occurrences, *mapping;
+  uint32_t* remap;
+  uint16_t* palette;
+  struct reduction_error error;
+  struct tileset set;
+  uint8_t* data;
+
+  tileset_init(&set);
+  remap = add_tiles_to_tileset(&set, png_ptr, info_ptr, row_pointers, bitplane_count, 0, map, &tile_count);
+  unique_count = set.count;
+
+  occurrences = calloc(unique_count, sizeof(unsigned int));
+  for(size_t i = 0; i < tile_count; i++)
+    occurrences[remap[i]]++;
+
+  //Direct color pixels are colors themselves
+  if(args.direct_color)
+  {
+    palette = malloc(256 * sizeof(uint16_t));
+    for(size_t i = 0; i < 256; i++)
+      palette[i] = direct_color_to_bgr15(i, 0);
+  }
+  else
+    palette = get_bgr15_palette(png_ptr, info_ptr);
+
+  mapping = malloc(unique_count * sizeof(unsigned int));
+  reduce_tileset(&set, occurrences, palette, args.max_tiles, mapping, &error);
+
+  //Point the BG map to the representative tiles
+  for(size_t k = 0; k < tile_count; k++)
+  {
+    unsigned int tile = mapping[remap[k]];
+    tilemap_set(map, k % columns, k / columns, tile, tile_palette(set.tiles + (tile * TILE_SIZE), bitplane_count), 0);
+  }
+
+  if(args.verbose)
+  {
+    fprintf(stderr, "Reduced %u unique tiles to %u\n", unique_count, set.count);
+
+    if(unique_count > set.count)
+    {
+      fprintf(stderr, "%u of %u tiles changed, mean error is %.3f per pixel, worst tile error is %u\n", error.changed_tiles, tile_count, error.mean_pixel_error, error.max_tile_error);
+    }
+  }
+
+  //The BG map would wrap to other tiles
+  if(set.count + args.tile_offset > TILEMAP_MAX_TILES)
+  {
+    fprintf(stderr, "Tileset holds %u tiles from tile %u, BG map entries can only address %u (see --max-tiles)\n", set.count, args.tile_offset, TILEMAP_MAX_TILES);
+    data = NULL;
+  }
+  else
+    data = convert_tileset(&set, bitplane_count, data_size);
+
+  free(mapping);
+  free(palette);
+  free(occurrences);
+  free(remap);
+  tileset_free(&set);
+
+  return data;
+}
+
+uint8_t* convert_deduplicated_tiles(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int bitplane_count, struct tilemap* map, struct arguments args, unsigned int* data_size)
+{
+  unsigned int tile_count;
+  struct tileset set;
+  uint32_t* remap;
+  uint8_t* data;
+
+  tileset_init(&set);
+  remap = add_tiles_to_tileset(&set, png_ptr, info_ptr, row_pointers, bitplane_count, args.dedup, map, &tile_count);
+
+  if(args.verbose)
+    fprintf(stderr, "Deduplicated %u tiles to %u\n", tile_count, set.count);
+
+  //The BG map would wrap to other tiles
+  if(set.count + args.tile_offset > TILEMAP_MAX_TILES)
+  {
+    fprintf(stderr, "Tileset holds %u tiles from tile %u, BG map entries can only address %u\n", set.count, args.tile_offset, TILEMAP_MAX_TILES);
+    data = NULL;
+  }
+  else
+    data = convert_tileset(&set, bitplane_count, data_size);
+
+  free(remap);
+  tileset_free(&set);
+
+  return data;
+}
+
+//The metasprites are output by the caller, after the characters
+uint8_t* generate_sprites(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int bitplane_count, struct arguments args, struct metasprite** metasprites, unsigned int* frame_count, unsigned int* data_size)
+{
+  unsigned int frame_width = args.frame_width, frame_height = args.frame_height;
+  unsigned int obj_count = 0;
+  uint8_t* data;
+
+  //Without frames, the whole image is a single sprite
+  if(frame_width == 0)
+  {
+    frame_width = png_get_image_width(png_ptr, info_ptr) & ~7;
+    frame_height = png_get_image_height(png_ptr, info_ptr) & ~7;
+  }
+
+  data = convert_sprites(png_ptr, info_ptr, row_pointers, bitplane_count, frame_width, frame_height, args.obj_small, args.obj_large, metasprites, frame_count, data_size);
+
+  for(size_t i = 0; i < *frame_count; i++)
+  {
+    //The OBJ count of a frame is a single byte, and OAM holds 128 OBJs
+    if((*metasprites)[i].count > OBJ_MAX_COUNT)
+    {
+      fprintf(stderr, "Frame %lu needs %u OBJs, OAM only holds %u\n", i, (*metasprites)[i].count, OBJ_MAX_COUNT);
+      free(data);
+      data = NULL;
+    }
+
+    obj_count += (*metasprites)[i].count;
+  }
+
+  //Character numbers of OBJs are 9 bits
+  if(data && *data_size / (8 * bitplane_count) > OBJ_MAX_TILES)
+  {
+    fprintf(stderr, "Sprites use %u characters, OBJs can only address %u\n", *data_size / (8 * bitplane_count), OBJ_MAX_TILES);
+    free(data);
+    data = NULL;
+  }
+
+  if(!data)
+  {
+    free_metasprites(*metasprites, *frame_count);
+    *metasprites = NULL;
+
+    return NULL;
+  }
+
+  if(args.verbose)
+    fprintf(stderr, "%u frames use %u OBJs (%ux%u and %ux%u) and %u characters\n", *frame_count, obj_count, args.obj_small, args.obj_small, args.obj_large, args.obj_large, *data_size / (8 * bitplane_count));
+
+  return data;
+}
+
@@ -1,6 +1,8 @@
 #ifndef MAIN_H
 #define MAIN_H
 
-//void convert_tiles(png_structp png_ptr, png_infop info_ptr, struct arguments args, FILE* output);
+#include "argparser.h"
+
+int convert_file(struct arguments args);
 
 #endif
@@ -0,0 +1,419 @@
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "manifest.h"
+#include "output.h"
+#include "pngfunctions.h"
+
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+struct manifest_entry
+{
+  char** inputs;
+  int input_count;
+  char* outputs[MANIFEST_MAX_OUTPUTS];
+  int output_count;
+};
+
+struct stamp_list
+{
+  uint64_t* hashes;
+  size_t count;
+  size_t capacity;
+};
+
+void stamp_list_add(struct stamp_list* list, uint64_t hash)
+{
+  if(list->count == list->capacity)
+  {
+    list->capacity = list->capacity ? list->capacity * 2 : 64;
+    list->hashes = realloc(list->hashes, list->capacity * sizeof(uint64_t));
+  }
+
+  list->hashes[list->count++] = hash;
+}
+
+int stamp_list_contains(struct stamp_list* list, uint64_t hash)
+{
+  for(size_t i = 0; i < list->count; i++)
+  {
+    if(list->hashes[i] == hash)
+      return 1;
+  }
+
+  return 0;
+}
+
+void read_stamp_file(char* filename, struct stamp_list* list)
+{
+  unsigned long long hash;
+  FILE* fp = fopen(filename, "r");
+
+  //A missing stamp file simply means everything is outdated
+  if(!fp)
+    return;
+
+  while(fscanf(fp, "%llx", &hash) == 1)
+    stamp_list_add(list, hash);
+
+  fclose(fp);
+}
+
+void write_stamp_file(char* filename, struct stamp_list* list)
+{
+  FILE* fp = fopen(filename, "w");
+
+  if(!fp)
+  {
+    perror(filename);
+    return;
+  }
+
+  for(size_t i = 0; i < list->count; i++)
+    fprintf(fp, "%016llx\n", (unsigned long long)list->hashes[i]);
+
+  fclose(fp);
+}
+
+//Split a manifest line into an argv-like array. Double quotes group words
+//and '#' starts a comment. The line is modified in place.
+int tokenize_line(char* line, char** tokens, int max_tokens)
+{
+  int count = 0;
+  char* p = line;
+
+  while(*p)
+  {
+    while(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+      p++;
+
+    if(*p == '\0' || *p == '#')
+      break;
+
+    if(count == max_tokens)
+      return -1;
+
+    if(*p == '"')
+    {
+      tokens[count++] = ++p;
+      while(*p && *p != '"')
+        p++;
+    }
+    else
+    {
+      tokens[count++] = p;
+      while(*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+        p++;
+    }
+
+    if(*p)
+      *p++ = '\0';
+  }
+
+  return count;
+}
+
+//Hash the tokens of an entry so that changing its options makes it outdated.
+//Hashes are chained by passing the previous one, or FNV_OFFSET_BASIS.
+uint64_t hash_tokens(uint64_t hash, char** tokens, int count)
+{
+  for(int i = 0; i < count; i++)
+  {
+    for(char* p = tokens[i]; ; p++)
+    {
+      hash = (hash ^ (uint8_t)*p) * FNV_PRIME;
+
+      if(*p == '\0')
+        break;
+    }
+  }
+
+  return hash;
+}
+
+//List the files written by a conversion with the given arguments
+int list_outputs(struct arguments* args, char** outputs)
+{
+  int count = 0;
+
+  //Only the shared tileset is tracked, assets are written along with it
+  if(args->shared_tileset)
+    return asprintf(&outputs[count++], args->binary ? "%s.vra" : "%s_vram.asm", args->output_file) == -1 ? -1 : count;
+
+  //Same for the shared palette
+  if(args->shared_palette)
+    return asprintf(&outputs[count++], args->binary ? "%s.cgr" : "%s_cgram.asm", args->output_file) == -1 ? -1 : count;
+
+  //Both layers are written after the palette, the back layer last
+  if(args->split_layers)
+    return asprintf(&outputs[count++], args->binary ? "%s_back.vra" : "%s_back_vram.asm", args->output_file) == -1 ? -1 : count;
+
+  //Only the tiles of the last region are tracked, they are written last
+  if(args->region_count > 1)
+  {
+    char* basename = region_basename(args->output_file, args->region_count - 1, args->region_count);
+
+    if(!basename || asprintf(&outputs[count++], args->binary ? "%s.vra" : "%s_vram.asm", basename) == -1)
+      count = -1;
+
+    free(basename);
+    return count;
+  }
+
+  //Variants are written after the main output, the last one is tracked
+  if(args->emit_count > 0 && asprintf(&outputs[count++], args->binary ? "%s.vra" : "%s_vram.asm", args->emits[args->emit_count - 1].output_file) == -1)
+    return -1;
+
+  if(args->binary)
+  {
+    if(!args->direct_color && asprintf(&outputs[count++], "%s.cgr", args->output_file) == -1)
+      return -1;
+    if(asprintf(&outputs[count++], "%s.vra", args->output_file) == -1)
+      return -1;
+    if(args->tilemap && asprintf(&outputs[count++], "%s.map", args->output_file) == -1)
+      return -1;
+    if(args->sprite && asprintf(&outputs[count++], "%s.spr", args->output_file) == -1)
+      return -1;
+    if(args->gradient && asprintf(&outputs[count++], "%s.hdm", args->output_file) == -1)
+      return -1;
+  }
+  else
+  {
+    if(!args->direct_color && asprintf(&outputs[count++], "%s_cgram.asm", args->output_file) == -1)
+      return -1;
+    if(asprintf(&outputs[count++], "%s_vram.asm", args->output_file) == -1)
+      return -1;
+    if(args->tilemap && asprintf(&outputs[count++], "%s_map.asm", args->output_file) == -1)
+      return -1;
+    if(args->sprite && asprintf(&outputs[count++], "%s_sprites.asm", args->output_file) == -1)
+      return -1;
+    if(args->gradient && asprintf(&outputs[count++], "%s_hdma.asm", args->output_file) == -1)
+      return -1;
+  }
+
+  return count;
+}
+
+//An entry is outdated when an output is missing or older than an input
+int is_outdated(struct manifest_entry* entry)
+{
+  struct stat input_stat, output_stat;
+
+  for(int i = 0; i < entry->output_count; i++)
+  {
+    if(stat(entry->outputs[i], &output_stat) != 0)
+      return 1;
+
+    for(int j = 0; j < entry->input_count; j++)
+    {
+      if(stat(entry->inputs[j], &input_stat) != 0)
+        return 1;
+
+      if(output_stat.st_mtim.tv_sec < input_stat.st_mtim.tv_sec)
+        return 1;
+
+      if(output_stat.st_mtim.tv_sec == input_stat.st_mtim.tv_sec && output_stat.st_mtim.tv_nsec < input_stat.st_mtim.tv_nsec)
+        return 1;
+    }
+  }
+
+  return 0;
+}
+
+//Write a make dependency file. The stamp depends on the manifest and every
+//input, and every output depends on the stamp.
+void write_depfile(char* filename, char* stamp_filename, char* manifest_filename, struct manifest_entry* entries, size_t entry_count)
+{
+  FILE* fp = fopen(filename, "w");
+
+  if(!fp)
+  {
+    perror(filename);
+    return;
+  }
+
+  fprintf(fp, "%s: %s", stamp_filename, manifest_filename);
+  for(size_t i = 0; i < entry_count; i++)
+  {
+    for(int j = 0; j < entries[i].input_count; j++)
+      fprintf(fp, " \\\n  %s", entries[i].inputs[j]);
+  }
+  fprintf(fp, "\n\n");
+
+  for(size_t i = 0; i < entry_count; i++)
+  {
+    for(int j = 0; j < entries[i].output_count; j++)
+      fprintf(fp, "%s ", entries[i].outputs[j]);
+    fprintf(fp, ": %s\n", stamp_filename);
+  }
+
+  //Empty rules so that make does not fail when an input is removed
+  for(size_t i = 0; i < entry_count; i++)
+  {
+    for(int j = 0; j < entries[i].input_count; j++)
+      fprintf(fp, "\n%s:\n", entries[i].inputs[j]);
+  }
+
+  fclose(fp);
+}
+
+int process_manifest(struct arguments args, convert_function convert)
+{
+  FILE* fp;
+  char *line = NULL, *stamp_filename, *depfile_filename;
+  char* tokens[MANIFEST_MAX_TOKENS + 1];
+  size_t line_capacity = 0, line_number = 0;
+  size_t entry_count = 0, entry_capacity = 0;
+  unsigned int converted = 0, up_to_date = 0, failed = 0;
+  struct manifest_entry* entries = NULL;
+  struct stamp_list old_stamps = { NULL, 0, 0 }, new_stamps = { NULL, 0, 0 };
+  uint64_t options_hash;
+
+  fp = fopen(args.manifest_file, "r");
+  if(!fp)
+  {
+    perror(args.manifest_file);
+    return -1;
+  }
+
+  if(asprintf(&stamp_filename, "%s.stamp", args.manifest_file) == -1)
+  {
+    fclose(fp);
+    return -1;
+  }
+
+  if(asprintf(&depfile_filename, "%s.d", args.manifest_file) == -1)
+  {
+    free(stamp_filename);
+    fclose(fp);
+    return -1;
+  }
+
+  read_stamp_file(stamp_filename, &old_stamps);
+
+  //Entries inherit the command line, changing it makes every entry outdated
+  options_hash = hash_tokens(FNV_OFFSET_BASIS, args.options, args.option_count);
+
+  //Program name expected by the argument parser
+  tokens[0] = "png2snes";
+
+  while(getline(&line, &line_capacity, fp) != -1)
+  {
+    struct arguments entry_args = args;
+    struct manifest_entry* entry;
+    char* basename = NULL;
+    uint64_t hash;
+    int token_count;
+
+    line_number++;
+
+    token_count = tokenize_line(line, tokens + 1, MANIFEST_MAX_TOKENS);
+    if(token_count == 0)
+      continue;
+
+    if(token_count < 0)
+    {
+      fprintf(stderr, "%s:%lu: Too many arguments\n", args.manifest_file, line_number);
+      failed++;
+      continue;
+    }
+
+    if(parse_manifest_entry(&entry_args, token_count + 1, tokens) != 0)
+    {
+      fprintf(stderr, "%s:%lu: Invalid entry\n", args.manifest_file, line_number);
+      failed++;
+      continue;
+    }
+
+    //Without an explicit output, write next to the input
+    if(strcmp(entry_args.output_file, "-") == 0)
+    {
+      basename = strip_png_extension(entry_args.input_file);
+      entry_args.output_file = basename;
+    }
+
+    if(entry_count == entry_capacity)
+    {
+      entry_capacity = entry_capacity ? entry_capacity * 2 : 64;
+      entries = realloc(entries, entry_capacity * sizeof(struct manifest_entry));
+    }
+
+    entry = &entries[entry_count++];
+    entry->input_count = entry_args.input_count;
+    entry->inputs = malloc(entry->input_count * sizeof(char*));
+    for(int i = 0; i < entry->input_count; i++)
+      entry->inputs[i] = strdup(entry_args.input_files[i]);
+
+    entry->output_count = list_outputs(&entry_args, entry->outputs);
+
+    if(entry->output_count < 0)
+    {
+      perror("process_manifest");
+      entry->output_count = 0;
+      failed++;
+    }
+    else
+    {
+      hash = hash_tokens(options_hash, tokens + 1, token_count);
+
+      if(!stamp_list_contains(&old_stamps, hash) || is_outdated(entry))
+      {
+        if(convert(entry_args) == 0)
+        {
+          stamp_list_add(&new_stamps, hash);
+          converted++;
+        }
+        else
+        {
+          fprintf(stderr, "%s:%lu: Conversion of %s failed\n", args.manifest_file, line_number, entry_args.input_file);
+          failed++;
+        }
+      }
+      else
+      {
+        if(args.verbose)
+          fprintf(stderr, "%s is up to date\n", entry_args.input_file);
+
+        stamp_list_add(&new_stamps, hash);
+        up_to_date++;
+      }
+    }
+
+    free(entry_args.input_files);
+    free(entry_args.regions);
+    for(int i = 0; i < entry_args.emit_count; i++)
+      free(entry_args.emits[i].output_file);
+    free(entry_args.emits);
+    free(basename);
+  }
+
+  write_stamp_file(stamp_filename, &new_stamps);
+  write_depfile(depfile_filename, stamp_filename, args.manifest_file, entries, entry_count);
+
+  fprintf(stderr, "%s: %u converted, %u up to date, %u failed\n", args.manifest_file, converted, up_to_date, failed);
+
+  for(size_t i = 0; i < entry_count; i++)
+  {
+    for(int j = 0; j < entries[i].input_count; j++)
+      free(entries[i].inputs[j]);
+    free(entries[i].inputs);
+
+    for(int j = 0; j < entries[i].output_count; j++)
+      free(entries[i].outputs[j]);
+  }
+
+  free(entries);
+  free(old_stamps.hashes);
+  free(new_stamps.hashes);
+  free(depfile_filename);
+  free(stamp_filename);
+  free(line);
+  fclose(fp);
+
+  return failed ? -1 : 0;
+}
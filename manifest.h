@@ -0,0 +1,14 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include "argparser.h"
+
+/* Converts a single asset, returns 0 on success */
+typedef int (*convert_function)(struct arguments args);
+
+int process_manifest(struct arguments args, convert_function convert);
+
+#define MANIFEST_MAX_TOKENS 64
+#define MANIFEST_MAX_OUTPUTS 8
+
+#endif //MANIFEST_H
@@ -0,0 +1,65 @@
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mode7.h"
+#include "tile.h"
+#include "tileset.h"
+
+//Build the 128x128 map and the 256 characters of Mode 7. Characters are 8bpp
+//chunky, so the decoded rows are copied as is. Map bytes go in the low byte
+//of each VRAM word and character bytes in the high byte.
+uint8_t* convert_mode7(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int* tile_count, unsigned int* data_size)
+{
+  unsigned int height = png_get_image_height(png_ptr, info_ptr);
+  unsigned int width = png_get_image_width(png_ptr, info_ptr);
+  unsigned int horizontal_tiles = width / 8, vertical_tiles = height / 8;
+  uint8_t map[MODE7_MAP_SIZE * MODE7_MAP_SIZE];
+  uint8_t tile[TILE_SIZE];
+  struct tileset set;
+  uint8_t* data;
+
+  if(horizontal_tiles > MODE7_MAP_SIZE || vertical_tiles > MODE7_MAP_SIZE)
+  {
+    fprintf(stderr, "Image is %ux%u tiles, Mode 7 map is clipped to %ux%u\n", horizontal_tiles, vertical_tiles, MODE7_MAP_SIZE, MODE7_MAP_SIZE);
+    horizontal_tiles = horizontal_tiles > MODE7_MAP_SIZE ? MODE7_MAP_SIZE : horizontal_tiles;
+    vertical_tiles = vertical_tiles > MODE7_MAP_SIZE ? MODE7_MAP_SIZE : vertical_tiles;
+  }
+
+  //Cells outside of the image point to character 0
+  memset(map, 0, sizeof(map));
+  tileset_init(&set);
+
+  for(size_t i = 0; i < vertical_tiles; i++)
+  {
+    for(size_t j = 0; j < horizontal_tiles; j++)
+    {
+      get_tile_from_png(tile, png_ptr, row_pointers, j, i);
+      map[(i * MODE7_MAP_SIZE) + j] = tileset_add(&set, tile);
+    }
+  }
+
+  *tile_count = set.count;
+
+  if(set.count > MODE7_MAX_TILES)
+  {
+    fprintf(stderr, "Image contains %u unique tiles, Mode 7 only has %u\n", set.count, MODE7_MAX_TILES);
+    tileset_free(&set);
+    return NULL;
+  }
+
+  *data_size = MODE7_VRAM_SIZE;
+  data = calloc(MODE7_VRAM_SIZE, 1);
+
+  for(size_t i = 0; i < MODE7_MAP_SIZE * MODE7_MAP_SIZE; i++)
+    data[i * 2] = map[i];
+
+  for(size_t i = 0; i < set.count * TILE_SIZE; i++)
+    data[(i * 2) + 1] = set.tiles[i];
+
+  tileset_free(&set);
+
+  return data;
+}
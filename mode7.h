@@ -0,0 +1,13 @@
+#ifndef MODE7_H
+#define MODE7_H
+#include <stdint.h>
+
+uint8_t* convert_mode7(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int* tile_count, unsigned int* data_size);
+
+#define MODE7_MAP_SIZE 128
+#define MODE7_MAX_TILES 256
+
+/* Map bytes and character bytes share each VRAM word */
+#define MODE7_VRAM_SIZE (MODE7_MAP_SIZE * MODE7_MAP_SIZE * 2)
+
+#endif //MODE7_H
@@ -0,0 +1,165 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "output.h"
+#include "rom.h"
+
+/* Binary output collected in memory while a ROM is patched */
+static FILE* patch_stream = NULL;
+static char* patch_buffer = NULL;
+static size_t patch_size = 0;
+static char* patch_name = NULL;
+
+FILE* open_output(char* basename, char* suffix, int binary)
+{
+  FILE* fp;
+  char* filename;
+
+  //Text output goes to standard output when no basename is given
+  if(!binary && strcmp(basename, "-") == 0)
+    return stdout;
+
+  if(asprintf(&filename, "%s%s", basename, suffix) == -1)
+  {
+    perror("open_output");
+    return NULL;
+  }
+
+  //Binary output goes straight into the ROM, no file is written
+  if(binary && rom_is_open())
+  {
+    patch_stream = open_memstream(&patch_buffer, &patch_size);
+    patch_name = filename;
+    return patch_stream;
+  }
+
+  fp = fopen(filename, binary ? "wb" : "w");
+
+  if(!fp)
+    perror(filename);
+
+  free(filename);
+  return fp;
+}
+
+//Returns -1 when the output could not be written into the ROM, rom_close
+//then fails too so the conversion still exits with an error
+int close_output(FILE* fp)
+{
+  int result = 0;
+
+  if(fp != NULL && fp == patch_stream)
+  {
+    fclose(fp);
+    result = rom_write((uint8_t*)patch_buffer, patch_size, patch_name);
+
+    free(patch_buffer);
+    free(patch_name);
+    patch_stream = NULL;
+    patch_buffer = NULL;
+    patch_name = NULL;
+    return result;
+  }
+
+  if(fp != stdout && fp != NULL)
+    fclose(fp);
+
+  return result;
+}
+
+//Basename of the outputs of one region. Several regions are numbered, but
+//still share standard output.
+char* region_basename(char* basename, int region, int region_count)
+{
+  char* name;
+
+  if(region_count <= 1 || strcmp(basename, "-") == 0)
+    return strdup(basename);
+
+  if(asprintf(&name, "%s_%d", basename, region) == -1)
+    return NULL;
+
+  return name;
+}
+
+void output_words_binary(char* basename, char* suffix, uint16_t* data, int words)
+{
+  FILE* fp = open_output(basename, suffix, 1);
+
+  if(!fp)
+    return;
+
+  for(size_t i = 0; i < words; i++)
+  {
+    putc(data[i] & 0xFF, fp);
+    putc(data[i] >> 8, fp);
+  }
+
+  close_output(fp);
+}
+
+void output_words_wla(char* basename, char* suffix, uint16_t* data, int words)
+{
+  FILE* fp = open_output(basename, suffix, 0);
+
+  if(!fp)
+    return;
+
+  for(size_t i = 0; i < words; i++)
+  {
+    if((i & 0x07) == 0)
+      fprintf(fp, "\n\t.dw ");
+
+    fprintf(fp, "$%04X", data[i]);
+
+    if(((i & 0x07) < 7) && (i < (words-1)))
+        fprintf(fp, ", ");
+  }
+
+  fprintf(fp, "\n");
+
+  close_output(fp);
+}
+
+void output_dwords_binary(char* basename, char* suffix, uint32_t* data, int dwords)
+{
+  FILE* fp = open_output(basename, suffix, 1);
+
+  if(!fp)
+    return;
+
+  for(size_t i = 0; i < dwords; i++)
+  {
+    putc(data[i] & 0xFF, fp);
+    putc((data[i] >> 8) & 0xFF, fp);
+    putc((data[i] >> 16) & 0xFF, fp);
+    putc(data[i] >> 24, fp);
+  }
+
+  close_output(fp);
+}
+
+void output_dwords_wla(char* basename, char* suffix, uint32_t* data, int dwords)
+{
+  FILE* fp = open_output(basename, suffix, 0);
+
+  if(!fp)
+    return;
+
+  for(size_t i = 0; i < dwords; i++)
+  {
+    if((i & 0x07) == 0)
+      fprintf(fp, "\n\t.dd ");
+
+    fprintf(fp, "$%08X", data[i]);
+
+    if(((i & 0x07) < 7) && (i < (dwords-1)))
+        fprintf(fp, ", ");
+  }
+
+  fprintf(fp, "\n");
+
+  close_output(fp);
+}
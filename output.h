@@ -0,0 +1,14 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+#include <stdint.h>
+#include <stdio.h>
+
+FILE* open_output(char* basename, char* suffix, int binary);
+int close_output(FILE* fp);
+char* region_basename(char* basename, int region, int region_count);
+void output_words_binary(char* basename, char* suffix, uint16_t* data, int words);
+void output_words_wla(char* basename, char* suffix, uint16_t* data, int words);
+void output_dwords_binary(char* basename, char* suffix, uint32_t* data, int dwords);
+void output_dwords_wla(char* basename, char* suffix, uint32_t* data, int dwords);
+
+#endif //OUTPUT_H
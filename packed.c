@@ -0,0 +1,73 @@
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "packed.h"
+#include "tile.h"
+
+//Drop the top bitplane of 2bpp and 4bpp tiles for ROM storage. A 1bpp tile
+//is plane 0 of each row, and a 3bpp tile is planes 0 and 1 exactly like
+//VRAM followed by plane 2 of each row. Expanding a 3bpp tile copies its
+//first 16 bytes as they are, then like a 1bpp tile every remaining byte
+//goes to the low byte of a VRAM word with a zero high byte.
+//Tiles are packed in place. Returns the packed size, or 0 when a tile
+//uses the top bitplane.
+unsigned int pack_tiles(uint8_t* data, unsigned int data_size, unsigned int bitplane_count)
+{
+  unsigned int bytes_per_tile = 8 * bitplane_count;
+  unsigned int packed_size = PACKED_TILE_SIZE(bitplane_count);
+  unsigned int tile_count = data_size / bytes_per_tile;
+  unsigned int plane_offset = bytes_per_tile - SUBTILE_SIZE;
+
+  for(size_t i = 0; i < tile_count; i++)
+  {
+    uint8_t* tile = data + (i * bytes_per_tile);
+    uint8_t* packed = data + (i * packed_size);
+    uint8_t planes[8];
+
+    for(size_t row = 0; row < 8; row++)
+    {
+      if(tile[plane_offset + (row * 2) + 1])
+      {
+        fprintf(stderr, "Tile %lu uses %u bitplanes, it cannot be packed\n", i, bitplane_count);
+        return 0;
+      }
+
+      planes[row] = tile[plane_offset + (row * 2)];
+    }
+
+    //Packed tiles are never bigger, so moving them forward is safe
+    if(bitplane_count == 4)
+    {
+      memmove(packed, tile, SUBTILE_SIZE);
+      memcpy(packed + SUBTILE_SIZE, planes, 8);
+    }
+    else
+      memcpy(packed, planes, 8);
+  }
+
+  return tile_count * packed_size;
+}
+
+//Reference expansion of packed tiles back to 2bpp or 4bpp VRAM tiles
+void unpack_tiles(uint8_t* destination, const uint8_t* source, unsigned int tile_count, unsigned int bitplane_count)
+{
+  unsigned int bytes_per_tile = 8 * bitplane_count;
+  unsigned int packed_size = PACKED_TILE_SIZE(bitplane_count);
+  unsigned int plane_offset = bytes_per_tile - SUBTILE_SIZE;
+
+  for(size_t i = 0; i < tile_count; i++)
+  {
+    uint8_t* tile = destination + (i * bytes_per_tile);
+    const uint8_t* packed = source + (i * packed_size);
+
+    memcpy(tile, packed, plane_offset);
+
+    for(size_t row = 0; row < 8; row++)
+    {
+      tile[plane_offset + (row * 2)] = packed[plane_offset + row];
+      tile[plane_offset + (row * 2) + 1] = 0;
+    }
+  }
+}
@@ -0,0 +1,11 @@
+#ifndef PACKED_H
+#define PACKED_H
+#include <stdint.h>
+
+unsigned int pack_tiles(uint8_t* data, unsigned int data_size, unsigned int bitplane_count);
+void unpack_tiles(uint8_t* destination, const uint8_t* source, unsigned int tile_count, unsigned int bitplane_count);
+
+/* Bytes of a packed tile for 2 and 4 bitplanes */
+#define PACKED_TILE_SIZE(bitplane_count) ((bitplane_count) == 2 ? 8 : 24)
+
+#endif //PACKED_H
@@ -3,15 +3,15 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "output.h"
 #include "palette.h"
 
-#define CONVERT_TO_BGR15(red, green, blue) (((blue & 0xF8) << 7) | ((green & 0xF8) << 2) | (red >> 3))
-
 uint16_t* convert_palette(png_structp png_ptr, png_infop info_ptr, int* size, int pad_to_size)
 {
   uint16_t* palette;
   png_color* png_palette;
   int src_size, final_size;
+  uint8_t* index;
 
   //Fetch Palette from PNG file
   png_get_PLTE(png_ptr, info_ptr, &png_palette, &src_size);
@@ -34,48 +34,93 @@ uint16_t* convert_palette(png_structp png_ptr, png_infop info_ptr, int* size, in
   for(size_t i = 0; i < src_size; i++)
     palette[i] = CONVERT_TO_BGR15(png_palette[i].red, png_palette[i].green, png_palette[i].blue);
 
-  for(size_t i = 1; i < src_size; i++)
+  //Index of the first entry of every BGR15 color, entry 0 is never compared
+  index = calloc(BGR15_INDEX_SIZE, sizeof(uint8_t));
+
+  for(size_t i = 1; i < src_size && i < 256; i++)
   {
-    for(size_t j = 1; j < i; j++)
-    {
-      if(palette[i] == palette[j])
-        fprintf(stderr, "Found duplicate colors %lu and %lu\n", i, j);
-    }
+    if(index[palette[i]])
+      fprintf(stderr, "Found duplicate colors %lu and %u\n", i, index[palette[i]]);
+    else
+      index[palette[i]] = i;
   }
 
+  free(index);
+
   *size = final_size;
 
   return palette;
 }
 
-void output_palette_binary(char* basename, uint16_t* data, int words)
+//Every palette entry in BGR15, padded to 256 colors
+uint16_t* get_bgr15_palette(png_structp png_ptr, png_infop info_ptr)
 {
-  FILE* fp;
-  char* filename;
+  png_color* png_palette;
+  int src_size;
+  uint16_t* palette = calloc(256, sizeof(uint16_t));
 
-  if(asprintf(&filename, "%s.cgr", basename) == -1)
+  png_get_PLTE(png_ptr, info_ptr, &png_palette, &src_size);
+
+  for(size_t i = 0; i < src_size && i < 256; i++)
+    palette[i] = CONVERT_TO_BGR15(png_palette[i].red, png_palette[i].green, png_palette[i].blue);
+
+  return palette;
+}
+
+//Merge the entries that are identical once narrowed to BGR15 and drop the
+//ones no pixel uses. Entry 0 stays in place. Fills the new index of every
+//entry and returns the number of colors left, entry 0 included.
+unsigned int optimize_palette(const uint16_t* palette, png_bytepp row_pointers, unsigned int width, unsigned int height, uint8_t* remap, uint16_t* optimized)
+{
+  unsigned int count = 1;
+  uint8_t used[256];
+  uint8_t* index = calloc(BGR15_INDEX_SIZE, sizeof(uint8_t));
+
+  memset(used, 0, sizeof(used));
+  memset(optimized, 0, 256 * sizeof(uint16_t));
+
+  for(size_t y = 0; y < height; y++)
   {
-    perror("output_palette_binary");
-    return;
+    for(size_t x = 0; x < width; x++)
+      used[row_pointers[y][x]] = 1;
   }
 
-  fp = fopen(filename, "wb");
+  optimized[0] = palette[0];
+  remap[0] = 0;
 
-  if(!fp)
+  for(size_t i = 1; i < 256; i++)
   {
-    perror(filename);
-    free(filename);
-    return;
+    remap[i] = 0;
+
+    if(!used[i])
+      continue;
+
+    if(!index[palette[i]])
+    {
+      index[palette[i]] = count;
+      optimized[count++] = palette[i];
+    }
+
+    remap[i] = index[palette[i]];
   }
 
-  for(size_t i = 0; i < words; i++)
+  free(index);
+
+  return count;
+}
+
+void remap_pixels(png_bytepp row_pointers, unsigned int width, unsigned int height, const uint8_t* remap)
+{
+  for(size_t y = 0; y < height; y++)
   {
-    putc(data[i] & 0xFF, fp);
-    putc(data[i] >> 8, fp);
+    for(size_t x = 0; x < width; x++)
+      row_pointers[y][x] = remap[row_pointers[y][x]];
   }
+}
 
-  free(filename);
-  fclose(fp);
+void output_palette_binary(char* basename, uint16_t* data, int words)
+{
+  output_words_binary(basename, ".cgr", data, words);
 }
 
 void output_palette_wla(char* basename, uint16_t* data, int words)
@@ -2,7 +2,14 @@
 #define PALETTE_H
 #include <stdint.h>
 
+#define BGR15_INDEX_SIZE 32768
+
+#define CONVERT_TO_BGR15(red, green, blue) (((blue & 0xF8) << 7) | ((green & 0xF8) << 2) | (red >> 3))
+
 uint16_t* convert_palette(png_structp png_ptr, png_infop info_ptr, int* size, int pad_to_size);
+uint16_t* get_bgr15_palette(png_structp png_ptr, png_infop info_ptr);
+unsigned int optimize_palette(const uint16_t* palette, png_bytepp row_pointers, unsigned int width, unsigned int height, uint8_t* remap, uint16_t* optimized);
+void remap_pixels(png_bytepp row_pointers, unsigned int width, unsigned int height, const uint8_t* remap);
 void output_palette_binary(char* basename, uint16_t* data, int words);
 void output_palette_wla(char* basename, uint16_t* data, int words);
 
@@ -0,0 +1,150 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "parallel.h"
+#include "trace.h"
+
+#define MAX_WORKERS 64
+
+struct range_job
+{
+  range_function function;
+  void* context;
+  unsigned int start;
+  unsigned int end;
+};
+
+unsigned int worker_count()
+{
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if(count < 1)
+    return 1;
+
+  return count > MAX_WORKERS ? MAX_WORKERS : count;
+}
+
+void* run_range_job(void* arg)
+{
+  struct range_job* job = arg;
+  uint64_t start = TRACE_BEGIN();
+
+  job->function(job->context, job->start, job->end);
+
+  TRACE_END("worker", NULL, start);
+
+  return NULL;
+}
+
+//Workers are started on the first call and then wait for the next range,
+//so that callers running many short loops do not pay for thread creation
+static struct
+{
+  pthread_once_t once;
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  pthread_t threads[MAX_WORKERS];
+  unsigned int thread_count;
+  struct range_job jobs[MAX_WORKERS];
+  unsigned int generation;
+  unsigned int pending;
+} pool = { PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+void* run_pool_worker(void* arg)
+{
+  unsigned int index = (uintptr_t)arg;
+  unsigned int generation = 0;
+
+  for(;;)
+  {
+    struct range_job job;
+
+    pthread_mutex_lock(&pool.lock);
+    while(pool.generation == generation)
+      pthread_cond_wait(&pool.work, &pool.lock);
+    generation = pool.generation;
+    job = pool.jobs[index];
+    pthread_mutex_unlock(&pool.lock);
+
+    if(job.function)
+      run_range_job(&job);
+
+    pthread_mutex_lock(&pool.lock);
+    if(--pool.pending == 0)
+      pthread_cond_signal(&pool.done);
+    pthread_mutex_unlock(&pool.lock);
+  }
+
+  return NULL;
+}
+
+//Start one thread less than the workers, the calling thread is the first.
+//Threads that cannot be created leave fewer workers.
+void start_pool()
+{
+  unsigned int count = worker_count();
+
+  for(unsigned int i = 1; i < count; i++)
+  {
+    if(pthread_create(&pool.threads[i], NULL, run_pool_worker, (void*)(uintptr_t)i) != 0)
+      break;
+
+    pthread_detach(pool.threads[i]);
+    pool.thread_count = i;
+  }
+}
+
+//Split the range in one contiguous chunk per worker, never smaller than
+//grain items. The calling thread processes the first chunk. Calls must not
+//be nested or made from several threads at once.
+void parallel_for(unsigned int count, unsigned int grain, range_function function, void* context)
+{
+  unsigned int workers, chunk;
+
+  if(grain == 0)
+    grain = 1;
+
+  pthread_once(&pool.once, start_pool);
+
+  workers = pool.thread_count + 1;
+  if(workers > (count + grain - 1) / grain)
+    workers = (count + grain - 1) / grain;
+
+  if(workers <= 1)
+  {
+    uint64_t start = TRACE_BEGIN();
+
+    function(context, 0, count);
+
+    TRACE_END("worker", NULL, start);
+    return;
+  }
+
+  chunk = (count + workers - 1) / workers;
+
+  pthread_mutex_lock(&pool.lock);
+
+  //Threads past the last chunk only report that they are done
+  for(unsigned int i = 0; i <= pool.thread_count; i++)
+  {
+    pool.jobs[i].function = i < workers ? function : NULL;
+    pool.jobs[i].context = context;
+    pool.jobs[i].start = i * chunk;
+    pool.jobs[i].end = (i + 1) * chunk < count ? (i + 1) * chunk : count;
+  }
+
+  pool.pending = pool.thread_count;
+  pool.generation++;
+  pthread_cond_broadcast(&pool.work);
+  pthread_mutex_unlock(&pool.lock);
+
+  run_range_job(&pool.jobs[0]);
+
+  pthread_mutex_lock(&pool.lock);
+  while(pool.pending > 0)
+    pthread_cond_wait(&pool.done, &pool.lock);
+  pthread_mutex_unlock(&pool.lock);
+}
@@ -0,0 +1,10 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/* Processes items [start, end) of a range */
+typedef void (*range_function)(void* context, unsigned int start, unsigned int end);
+
+unsigned int worker_count();
+void parallel_for(unsigned int count, unsigned int grain, range_function function, void* context);
+
+#endif //PARALLEL_H
@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <png.h>
 
 #include "pngfunctions.h"
@@ -76,9 +77,20 @@ int initialize_libpng(FILE* fp, png_structp* png_ptr, png_infop* info_ptr, png_i
   //Read file information
   png_read_info(*png_ptr, *info_ptr);
 
-  //Set User transform functions
-  png_set_read_user_transform_fn(*png_ptr, read_transform_fn);
-  png_set_user_transform_info(*png_ptr, png_get_user_transform_ptr(*png_ptr), 8, png_get_channels(*png_ptr, *info_ptr));
+  if(png_get_color_type(*png_ptr, *info_ptr) == PNG_COLOR_TYPE_PALETTE)
+  {
+    //Set User transform functions
+    png_set_read_user_transform_fn(*png_ptr, read_transform_fn);
+    png_set_user_transform_info(*png_ptr, png_get_user_transform_ptr(*png_ptr), 8, png_get_channels(*png_ptr, *info_ptr));
+  }
+  else
+  {
+    //Images without a palette are read as 8-bit RGB, with alpha if present
+    png_set_strip_16(*png_ptr);
+    png_set_expand_gray_1_2_4_to_8(*png_ptr);
+    png_set_gray_to_rgb(*png_ptr);
+  }
+
   png_read_update_info(*png_ptr, *info_ptr);
 
   return 1;
@@ -102,3 +114,113 @@ int detect_palette(png_structp png_ptr, png_infop info_ptr)
 
   return 1;
 }
+
+png_bytepp read_png(png_structp png_ptr, png_infop info_ptr)
+{
+  return read_png_rows(png_ptr, info_ptr, png_get_image_height(png_ptr, info_ptr));
+}
+
+//Decode the first rows of the image, one byte per pixel after the user
+//transform. The rest of the image is never inflated.
+png_bytepp read_png_rows(png_structp png_ptr, png_infop info_ptr, unsigned int row_count)
+{
+  unsigned int height = png_get_image_height(png_ptr, info_ptr);
+  unsigned int rowbytes = png_get_rowbytes(png_ptr, info_ptr);
+  int interlaced = png_get_interlace_type(png_ptr, info_ptr) != PNG_INTERLACE_NONE;
+
+  //Interlaced images only have their first rows after the last pass
+  png_bytepp row_pointers = malloc(sizeof(png_bytep) * (interlaced ? height : row_count));
+  for(size_t i = 0; i < (interlaced ? height : row_count); i++)
+    row_pointers[i] = malloc(sizeof(png_byte) * rowbytes);
+
+  if(interlaced)
+  {
+    png_read_image(png_ptr, row_pointers);
+
+    for(size_t i = row_count; i < height; i++)
+      free(row_pointers[i]);
+  }
+  else
+    png_read_rows(png_ptr, row_pointers, NULL, row_count);
+
+  return row_pointers;
+}
+
+//Make the image look like it only has the given size, so that a region of
+//the decoded rows can be converted as a whole image
+void set_png_size(png_structp png_ptr, png_infop info_ptr, unsigned int width, unsigned int height)
+{
+  png_set_IHDR(png_ptr, info_ptr, width, height, png_get_bit_depth(png_ptr, info_ptr), png_get_color_type(png_ptr, info_ptr), png_get_interlace_type(png_ptr, info_ptr), PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+}
+
+void free_png(png_bytepp row_pointers, unsigned int height)
+{
+  for(size_t i = 0; i < height; i++)
+    free(row_pointers[i]);
+
+  free(row_pointers);
+}
+
+//Write an 8-bit indexed PNG, expanding the BGR15 palette to 24 bits
+int write_indexed_png(const char* filename, png_bytepp row_pointers, unsigned int width, unsigned int height, const uint16_t* palette, unsigned int colors)
+{
+  png_structp png_ptr;
+  png_infop info_ptr;
+  png_color expanded[256];
+  FILE* fp = fopen(filename, "wb");
+
+  if(!fp)
+  {
+    perror(filename);
+    return -1;
+  }
+
+  png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if(!png_ptr)
+  {
+    fprintf(stderr, "Error creating libpng write struct\n");
+    fclose(fp);
+    return -1;
+  }
+
+  info_ptr = png_create_info_struct(png_ptr);
+  if(!info_ptr)
+  {
+    png_destroy_write_struct(&png_ptr, NULL);
+    fprintf(stderr, "Error creating info struct\n");
+    fclose(fp);
+    return -1;
+  }
+
+  //Replicate the top bits so that white stays white
+  for(size_t i = 0; i < colors; i++)
+  {
+    unsigned int red = palette[i] & 0x1F, green = (palette[i] >> 5) & 0x1F, blue = (palette[i] >> 10) & 0x1F;
+
+    expanded[i].red = (red << 3) | (red >> 2);
+    expanded[i].green = (green << 3) | (green >> 2);
+    expanded[i].blue = (blue << 3) | (blue >> 2);
+  }
+
+  png_init_io(png_ptr, fp);
+  png_set_IHDR(png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  png_set_PLTE(png_ptr, info_ptr, expanded, colors);
+  png_write_info(png_ptr, info_ptr);
+  png_write_image(png_ptr, row_pointers);
+  png_write_end(png_ptr, NULL);
+
+  png_destroy_write_struct(&png_ptr, &info_ptr);
+  fclose(fp);
+
+  return 0;
+}
+
+char* strip_png_extension(const char* filename)
+{
+  size_t length = strlen(filename);
+
+  if(length > 4 && strcmp(filename + length - 4, ".png") == 0)
+    length -= 4;
+
+  return strndup(filename, length);
+}
@@ -1,9 +1,15 @@
 #ifndef PNG_FUNCTIONS_H
 #define PNG_FUNCTIONS_H
+#include <stdint.h>
 
 int detect_png(FILE* fp);
 int initialize_libpng(FILE* fp, png_structp* png_ptr, png_infop* info_ptr, png_infop* end_info);
 int detect_palette();
-uint8_t* read_png(png_structp png_ptr, png_infop info_ptr);
+png_bytepp read_png(png_structp png_ptr, png_infop info_ptr);
+png_bytepp read_png_rows(png_structp png_ptr, png_infop info_ptr, unsigned int row_count);
+void set_png_size(png_structp png_ptr, png_infop info_ptr, unsigned int width, unsigned int height);
+void free_png(png_bytepp row_pointers, unsigned int height);
+char* strip_png_extension(const char* filename);
+int write_indexed_png(const char* filename, png_bytepp row_pointers, unsigned int width, unsigned int height, const uint16_t* palette, unsigned int colors);
 
 #endif //PNG_FUNCTIONS_H
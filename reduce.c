@@ -0,0 +1,316 @@
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parallel.h"
+#include "reduce.h"
+#include "tile.h"
+
+//Channels of the tile stored one after the other, five bits per value
+#define FEATURE_SIZE (TILE_SIZE * 3)
+
+struct reduce_context
+{
+  const uint8_t* features;
+  unsigned int tile_count;
+
+  const unsigned int* medoids;
+  unsigned int medoid_count;
+
+  //Index of the medoid added last, during initialization
+  unsigned int new_medoid;
+
+  unsigned int* assignment;
+  unsigned int* distance;
+};
+
+//Weighted squared distance between two tiles. Gives up once the distance
+//goes over bound, the caller only needs to know it is not closer.
+unsigned int tile_distance(const uint8_t* a, const uint8_t* b, unsigned int bound)
+{
+  unsigned int red = 0, green = 0, blue = 0, total;
+
+  //Simple loops over contiguous bytes so the compiler can vectorize them
+  for(size_t i = 0; i < TILE_SIZE; i++)
+  {
+    int d = (int)a[TILE_SIZE + i] - (int)b[TILE_SIZE + i];
+    green += d * d;
+  }
+
+  total = GREEN_WEIGHT * green;
+  if(total >= bound)
+    return total;
+
+  for(size_t i = 0; i < TILE_SIZE; i++)
+  {
+    int d = (int)a[i] - (int)b[i];
+    red += d * d;
+  }
+
+  total += RED_WEIGHT * red;
+  if(total >= bound)
+    return total;
+
+  for(size_t i = 0; i < TILE_SIZE; i++)
+  {
+    int d = (int)a[(TILE_SIZE * 2) + i] - (int)b[(TILE_SIZE * 2) + i];
+    blue += d * d;
+  }
+
+  return total + (BLUE_WEIGHT * blue);
+}
+
+//Unweighted squared distance, used to report the error
+unsigned int tile_error(const uint8_t* a, const uint8_t* b)
+{
+  unsigned int error = 0;
+
+  for(size_t i = 0; i < FEATURE_SIZE; i++)
+  {
+    int d = (int)a[i] - (int)b[i];
+    error += d * d;
+  }
+
+  return error;
+}
+
+uint8_t* compute_features(const struct tileset* set, const uint16_t* palette)
+{
+  uint8_t* features = malloc(set->count * FEATURE_SIZE);
+
+  for(size_t i = 0; i < set->count; i++)
+  {
+    const uint8_t* tile = set->tiles + (i * TILE_SIZE);
+    uint8_t* feature = features + (i * FEATURE_SIZE);
+
+    for(size_t j = 0; j < TILE_SIZE; j++)
+    {
+      uint16_t color = palette[tile[j]];
+
+      feature[j] = color & 0x1F;
+      feature[TILE_SIZE + j] = (color >> 5) & 0x1F;
+      feature[(TILE_SIZE * 2) + j] = (color >> 10) & 0x1F;
+    }
+  }
+
+  return features;
+}
+
+//Move tiles closer to the new medoid over to it
+void update_nearest_medoid(void* arg, unsigned int start, unsigned int end)
+{
+  struct reduce_context* context = arg;
+  const uint8_t* medoid = context->features + (context->medoids[context->new_medoid] * FEATURE_SIZE);
+
+  for(unsigned int i = start; i < end; i++)
+  {
+    unsigned int distance = tile_distance(context->features + (i * FEATURE_SIZE), medoid, context->distance[i]);
+
+    if(distance < context->distance[i])
+    {
+      context->distance[i] = distance;
+      context->assignment[i] = context->new_medoid;
+    }
+  }
+}
+
+void assign_to_medoids(void* arg, unsigned int start, unsigned int end)
+{
+  struct reduce_context* context = arg;
+
+  for(unsigned int i = start; i < end; i++)
+  {
+    const uint8_t* feature = context->features + (i * FEATURE_SIZE);
+
+    //Start from the previous medoid, it is usually still the nearest one
+    unsigned int best = context->assignment[i];
+    unsigned int best_distance = tile_distance(feature, context->features + (context->medoids[best] * FEATURE_SIZE), ~0u);
+
+    for(unsigned int j = 0; j < context->medoid_count && best_distance > 0; j++)
+    {
+      unsigned int distance = tile_distance(feature, context->features + (context->medoids[j] * FEATURE_SIZE), best_distance);
+
+      if(distance < best_distance)
+      {
+        best = j;
+        best_distance = distance;
+      }
+    }
+
+    context->assignment[i] = best;
+    context->distance[i] = best_distance;
+  }
+}
+
+//Pick medoids one at a time, each time taking the tile that is worst
+//represented, weighted by how often it is used
+void initialize_medoids(struct reduce_context* context, unsigned int* medoids, const unsigned int* occurrences, unsigned int max_tiles)
+{
+  unsigned int first = 0;
+
+  for(unsigned int i = 1; i < context->tile_count; i++)
+  {
+    if(occurrences[i] > occurrences[first])
+      first = i;
+  }
+
+  for(unsigned int i = 0; i < context->tile_count; i++)
+  {
+    context->assignment[i] = 0;
+    context->distance[i] = ~0u;
+  }
+
+  medoids[0] = first;
+  context->medoid_count = 1;
+
+  for(;;)
+  {
+    uint64_t worst_cost = 0;
+    unsigned int worst = 0;
+
+    context->new_medoid = context->medoid_count - 1;
+    parallel_for(context->tile_count, 256, update_nearest_medoid, context);
+
+    if(context->medoid_count == max_tiles)
+      break;
+
+    for(unsigned int i = 0; i < context->tile_count; i++)
+    {
+      uint64_t cost = (uint64_t)context->distance[i] * occurrences[i];
+
+      if(cost > worst_cost)
+      {
+        worst_cost = cost;
+        worst = i;
+      }
+    }
+
+    //Every tile is already represented exactly
+    if(worst_cost == 0)
+      break;
+
+    medoids[context->medoid_count++] = worst;
+  }
+}
+
+//Move each medoid to the member of its cluster closest to the cluster mean.
+//Returns the number of medoids that changed.
+unsigned int update_medoids(struct reduce_context* context, unsigned int* medoids, const unsigned int* occurrences)
+{
+  unsigned int changed = 0;
+  uint32_t* sums = calloc(context->medoid_count * FEATURE_SIZE, sizeof(uint32_t));
+  uint32_t* weights = calloc(context->medoid_count, sizeof(uint32_t));
+  uint8_t* means = malloc(context->medoid_count * FEATURE_SIZE);
+  unsigned int* best_distance = malloc(context->medoid_count * sizeof(unsigned int));
+
+  for(unsigned int i = 0; i < context->tile_count; i++)
+  {
+    const uint8_t* feature = context->features + (i * FEATURE_SIZE);
+    uint32_t* sum = sums + (context->assignment[i] * FEATURE_SIZE);
+
+    for(size_t j = 0; j < FEATURE_SIZE; j++)
+      sum[j] += feature[j] * occurrences[i];
+
+    weights[context->assignment[i]] += occurrences[i];
+  }
+
+  for(unsigned int i = 0; i < context->medoid_count; i++)
+  {
+    for(size_t j = 0; j < FEATURE_SIZE; j++)
+      means[(i * FEATURE_SIZE) + j] = (sums[(i * FEATURE_SIZE) + j] + (weights[i] / 2)) / weights[i];
+
+    best_distance[i] = tile_distance(context->features + (medoids[i] * FEATURE_SIZE), means + (i * FEATURE_SIZE), ~0u);
+  }
+
+  for(unsigned int i = 0; i < context->tile_count; i++)
+  {
+    unsigned int cluster = context->assignment[i];
+    unsigned int distance = tile_distance(context->features + (i * FEATURE_SIZE), means + (cluster * FEATURE_SIZE), best_distance[cluster]);
+
+    if(distance < best_distance[cluster])
+    {
+      best_distance[cluster] = distance;
+      medoids[cluster] = i;
+      changed++;
+    }
+  }
+
+  free(best_distance);
+  free(means);
+  free(weights);
+  free(sums);
+
+  return changed;
+}
+
+//Cluster the tiles of the set until at most max_tiles remain. The set is
+//replaced by the representative of each cluster, and mapping gives the new
+//index of every original tile. Returns the new number of tiles.
+int reduce_tileset(struct tileset* set, const unsigned int* occurrences, const uint16_t* palette, unsigned int max_tiles, unsigned int* mapping, struct reduction_error* error)
+{
+  struct reduce_context context;
+  struct tileset reduced;
+  unsigned int* medoids;
+  uint64_t total_error = 0, total_occurrences = 0;
+
+  memset(error, 0, sizeof(struct reduction_error));
+
+  if(set->count <= max_tiles)
+  {
+    for(unsigned int i = 0; i < set->count; i++)
+      mapping[i] = i;
+
+    return set->count;
+  }
+
+  medoids = malloc(max_tiles * sizeof(unsigned int));
+  context.features = compute_features(set, palette);
+  context.tile_count = set->count;
+  context.medoids = medoids;
+  context.assignment = malloc(set->count * sizeof(unsigned int));
+  context.distance = malloc(set->count * sizeof(unsigned int));
+
+  initialize_medoids(&context, medoids, occurrences, max_tiles);
+
+  for(unsigned int i = 0; i < REDUCE_ITERATIONS; i++)
+  {
+    if(update_medoids(&context, medoids, occurrences) == 0)
+      break;
+
+    parallel_for(context.tile_count, 64, assign_to_medoids, &context);
+  }
+
+  //Keep the representatives only
+  tileset_init(&reduced);
+  for(unsigned int i = 0; i < context.medoid_count; i++)
+    tileset_add(&reduced, set->tiles + (medoids[i] * TILE_SIZE));
+
+  for(unsigned int i = 0; i < set->count; i++)
+  {
+    unsigned int tile_error_value = tile_error(context.features + (i * FEATURE_SIZE), context.features + (medoids[context.assignment[i]] * FEATURE_SIZE));
+
+    mapping[i] = context.assignment[i];
+    total_error += (uint64_t)tile_error_value * occurrences[i];
+    total_occurrences += occurrences[i];
+
+    if(tile_error_value > error->max_tile_error)
+      error->max_tile_error = tile_error_value;
+
+    if(tile_error_value > 0)
+      error->changed_tiles += occurrences[i];
+  }
+
+  error->mean_pixel_error = (double)total_error / (total_occurrences * TILE_SIZE);
+
+  tileset_free(set);
+  *set = reduced;
+
+  free(context.distance);
+  free(context.assignment);
+  free((void*)context.features);
+  free(medoids);
+
+  return set->count;
+}
@@ -0,0 +1,23 @@
+#ifndef REDUCE_H
+#define REDUCE_H
+#include <stdint.h>
+
+#include "tileset.h"
+
+/* Error introduced by a reduction, in squared BGR15 distance */
+struct reduction_error
+{
+  double mean_pixel_error;
+  unsigned int max_tile_error;
+  unsigned int changed_tiles;
+};
+
+int reduce_tileset(struct tileset* set, const unsigned int* occurrences, const uint16_t* palette, unsigned int max_tiles, unsigned int* mapping, struct reduction_error* error);
+
+#define REDUCE_ITERATIONS 4
+
+#define RED_WEIGHT 3
+#define GREEN_WEIGHT 6
+#define BLUE_WEIGHT 1
+
+#endif //REDUCE_H
@@ -0,0 +1,261 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rom.h"
+
+/* ROM image being patched, mapped in memory */
+static struct
+{
+  int fd;
+  uint8_t* map;
+  size_t map_size;
+  uint8_t* data;
+  size_t size;
+  int hirom;
+  size_t offset;
+  unsigned int fast_bank;
+  int protect;
+  int update_checksum;
+  int verbose;
+  int failed;
+} rom = { -1 };
+
+//A header is valid when its map mode matches the mapping and the checksum
+//is the complement of its complement
+int valid_header(const uint8_t* header, int hirom)
+{
+  uint16_t complement = header[0x1C] | (header[0x1D] << 8);
+  uint16_t checksum = header[0x1E] | (header[0x1F] << 8);
+
+  return (header[0x15] & 0xE0) == 0x20 && (header[0x15] & 0x01) == hirom && (complement ^ checksum) == 0xFFFF;
+}
+
+//File offset of a LoROM or HiROM address, or -1 when it is not ROM
+long rom_offset(unsigned long address)
+{
+  unsigned int bank = (address >> 16) & 0xFF;
+  unsigned int offset = address & 0xFFFF;
+
+  if(rom.hirom)
+  {
+    if(bank >= 0xC0 || (bank >= 0x40 && bank < 0x7E))
+      return address & 0x3FFFFF;
+
+    if(offset >= 0x8000 && (bank & 0x7F) < 0x40)
+      return ((bank & 0x3F) << 16) | offset;
+
+    return -1;
+  }
+
+  //Only banks $7E and $7F are WRAM, $FE and $FF mirror the last ROM banks
+  if(offset < 0x8000 || bank == 0x7E || bank == 0x7F)
+    return -1;
+
+  return ((bank & 0x7F) * ROM_BANK_SIZE) + (offset - 0x8000);
+}
+
+unsigned long rom_address(size_t offset)
+{
+  if(rom.hirom)
+    return 0xC00000 | offset;
+
+  return rom.fast_bank | ((offset / ROM_BANK_SIZE) << 16) | 0x8000 | (offset % ROM_BANK_SIZE);
+}
+
+//Open a ROM given as FILE@ADDRESS for patching. The address is a SNES
+//address, in hexadecimal with a $ or 0x prefix.
+int rom_open(const char* spec, int protect, int update_checksum, int verbose)
+{
+  const char* at = strrchr(spec, '@');
+  char *filename, *endptr;
+  unsigned long address;
+  struct stat rom_stat;
+  long offset;
+
+  if(!at)
+  {
+    fprintf(stderr, "Missing address in %s (Expected ROM@ADDRESS)\n", spec);
+    return -1;
+  }
+
+  address = strtoul(at[1] == '$' ? at + 2 : at + 1, &endptr, at[1] == '$' ? 16 : 0);
+  if(*endptr != '\0' || endptr == at + 1)
+  {
+    fprintf(stderr, "Invalid ROM address %s\n", at + 1);
+    return -1;
+  }
+
+  filename = strndup(spec, at - spec);
+  rom.fd = open(filename, O_RDWR);
+
+  if(rom.fd < 0 || fstat(rom.fd, &rom_stat) != 0)
+  {
+    perror(filename);
+    free(filename);
+    return -1;
+  }
+
+  rom.map_size = rom_stat.st_size;
+  rom.map = mmap(NULL, rom.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, rom.fd, 0);
+
+  if(rom.map == MAP_FAILED)
+  {
+    perror(filename);
+    close(rom.fd);
+    free(filename);
+    rom.fd = -1;
+    return -1;
+  }
+
+  //Copier headers are not part of the address space
+  rom.data = rom.map;
+  rom.size = rom.map_size;
+  if((rom.size % 1024) == ROM_COPIER_HEADER_SIZE)
+  {
+    rom.data += ROM_COPIER_HEADER_SIZE;
+    rom.size -= ROM_COPIER_HEADER_SIZE;
+  }
+
+  rom.hirom = rom.size > ROM_HIROM_HEADER + 0x20 && valid_header(rom.data + ROM_HIROM_HEADER, 1) && !(rom.size > ROM_LOROM_HEADER + 0x20 && valid_header(rom.data + ROM_LOROM_HEADER, 0));
+  rom.fast_bank = address & 0x800000;
+  rom.protect = protect;
+  rom.verbose = verbose;
+
+  offset = rom_offset(address);
+  if(offset < 0 || offset >= rom.size)
+  {
+    fprintf(stderr, "Address $%06lX is outside of the %s ROM %s\n", address, rom.hirom ? "HiROM" : "LoROM", filename);
+    free(filename);
+    rom_close();
+    return -1;
+  }
+
+  rom.offset = offset;
+  rom.update_checksum = update_checksum;
+
+  if(update_checksum && rom.size < (rom.hirom ? ROM_HIROM_HEADER : ROM_LOROM_HEADER) + 0x20)
+  {
+    fprintf(stderr, "ROM is too small to have a header, its checksum is not updated\n");
+    rom.update_checksum = 0;
+  }
+
+  if(verbose)
+    fprintf(stderr, "Patching %s (%s, %lu bytes) from $%06lX\n", filename, rom.hirom ? "HiROM" : "LoROM", rom.size, address);
+
+  free(filename);
+  return 0;
+}
+
+int rom_is_open()
+{
+  return rom.fd >= 0;
+}
+
+//Write data at the current position and move past it
+int rom_write(const uint8_t* data, size_t size, const char* name)
+{
+  uint8_t* destination = rom.data + rom.offset;
+
+  //Data following a failed write would not land where it is expected
+  if(rom.failed)
+  {
+    fprintf(stderr, "%s is not written after the error above\n", name);
+    return -1;
+  }
+
+  if(rom.offset + size > rom.size)
+  {
+    fprintf(stderr, "%s (%lu bytes) does not fit at $%06lX, the ROM ends %lu bytes later\n", name, size, rom_address(rom.offset), rom.size - rom.offset);
+    rom.failed = 1;
+    return -1;
+  }
+
+  //Bytes already holding the data are fine, so patching twice works
+  if(rom.protect)
+  {
+    for(size_t i = 0; i < size; i++)
+    {
+      if(destination[i] != 0x00 && destination[i] != 0xFF && destination[i] != data[i])
+      {
+        fprintf(stderr, "%s would overwrite data at $%06lX\n", name, rom_address(rom.offset + i));
+        rom.failed = 1;
+        return -1;
+      }
+    }
+  }
+
+  if(!rom.hirom && (rom.offset % ROM_BANK_SIZE) + size > ROM_BANK_SIZE)
+    fprintf(stderr, "%s crosses the bank boundary at $%06lX\n", name, rom_address(((rom.offset / ROM_BANK_SIZE) + 1) * ROM_BANK_SIZE));
+
+  if(rom.verbose)
+    fprintf(stderr, "%s: %lu bytes at $%06lX\n", name, size, rom_address(rom.offset));
+
+  memcpy(destination, data, size);
+  rom.offset += size;
+
+  return 0;
+}
+
+//Sum of every byte, the part past the largest power of two is repeated
+//to fill it again
+uint16_t rom_checksum()
+{
+  size_t base = 1;
+  uint32_t sum = 0, rest = 0;
+
+  while(base * 2 <= rom.size)
+    base *= 2;
+
+  for(size_t i = 0; i < base; i++)
+    sum += rom.data[i];
+
+  if(base < rom.size)
+  {
+    for(size_t i = base; i < rom.size; i++)
+      rest += rom.data[i];
+
+    sum += rest * (base / (rom.size - base));
+  }
+
+  return sum;
+}
+
+int rom_close()
+{
+  if(!rom_is_open())
+    return 0;
+
+  if(rom.update_checksum)
+  {
+    uint8_t* header = rom.data + (rom.hirom ? ROM_HIROM_HEADER : ROM_LOROM_HEADER);
+    uint16_t checksum;
+
+    //The checksum covers itself, counted as if it was already valid
+    header[0x1C] = 0xFF;
+    header[0x1D] = 0xFF;
+    header[0x1E] = 0x00;
+    header[0x1F] = 0x00;
+
+    checksum = rom_checksum();
+    header[0x1C] = ~checksum & 0xFF;
+    header[0x1D] = (~checksum >> 8) & 0xFF;
+    header[0x1E] = checksum & 0xFF;
+    header[0x1F] = checksum >> 8;
+
+    if(rom.verbose)
+      fprintf(stderr, "ROM checksum is now $%04X\n", checksum);
+  }
+
+  msync(rom.map, rom.map_size, MS_SYNC);
+  munmap(rom.map, rom.map_size);
+  close(rom.fd);
+  rom.fd = -1;
+
+  return rom.failed ? -1 : 0;
+}
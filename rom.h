@@ -0,0 +1,19 @@
+#ifndef ROM_H
+#define ROM_H
+#include <stddef.h>
+#include <stdint.h>
+
+int rom_open(const char* spec, int protect, int update_checksum, int verbose);
+int rom_is_open();
+int rom_write(const uint8_t* data, size_t size, const char* name);
+int rom_close();
+long rom_offset(unsigned long address);
+unsigned long rom_address(size_t offset);
+uint16_t rom_checksum();
+
+#define ROM_COPIER_HEADER_SIZE 512
+#define ROM_LOROM_HEADER 0x7FC0
+#define ROM_HIROM_HEADER 0xFFC0
+#define ROM_BANK_SIZE 0x8000
+
+#endif //ROM_H
@@ -0,0 +1,105 @@
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "shared.h"
+#include "tile.h"
+#include "trace.h"
+
+void flip_tile(uint8_t* flipped, const uint8_t* tile, uint16_t flags)
+{
+  for(size_t y = 0; y < 8; y++)
+  {
+    size_t source_y = (flags & TILEMAP_VFLIP) ? 7 - y : y;
+
+    for(size_t x = 0; x < 8; x++)
+      flipped[(y * 8) + x] = tile[(source_y * 8) + ((flags & TILEMAP_HFLIP) ? 7 - x : x)];
+  }
+}
+
+//Add a tile to the set and return its index. The flip bits of the BG map
+//entry showing it are returned in flags. The tile is modified in place.
+unsigned int add_tile(struct tileset* set, uint8_t* tile, unsigned int bitplane_count, int dedup, uint16_t* flags)
+{
+  static const uint16_t flips[] = { TILEMAP_HFLIP, TILEMAP_VFLIP, TILEMAP_HFLIP | TILEMAP_VFLIP };
+  uint8_t flipped[TILE_SIZE];
+  int index;
+
+  *flags = 0;
+
+  //Indices relative to the sub-palette base, as stored in VRAM
+  if((dedup & DEDUP_PALETTE) && bitplane_count < 8)
+  {
+    for(size_t i = 0; i < TILE_SIZE; i++)
+      tile[i] &= (1 << bitplane_count) - 1;
+  }
+
+  if(dedup & DEDUP_FLIP)
+  {
+    //Prefer the tile as it is to a flipped match
+    if(tileset_find(set, tile, hash_tile(tile)) < 0)
+    {
+      for(size_t i = 0; i < sizeof(flips) / sizeof(flips[0]); i++)
+      {
+        flip_tile(flipped, tile, flips[i]);
+        index = tileset_find(set, flipped, hash_tile(flipped));
+
+        if(index >= 0)
+        {
+          *flags = flips[i];
+          return index;
+        }
+      }
+    }
+  }
+
+  return tileset_add(set, tile);
+}
+
+uint32_t* add_tiles_to_tileset(struct tileset* set, png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int bitplane_count, int dedup, struct tilemap* map, unsigned int* tile_count)
+{
+  unsigned int height = png_get_image_height(png_ptr, info_ptr);
+  unsigned int width = png_get_image_width(png_ptr, info_ptr);
+  unsigned int horizontal_tiles = width / 8;
+  unsigned int vertical_tiles = height / 8;
+  uint8_t tile[TILE_SIZE];
+  unsigned int palette;
+  uint32_t* remap;
+  uint16_t flags;
+
+  *tile_count = horizontal_tiles * vertical_tiles;
+  remap = malloc(*tile_count * sizeof(uint32_t));
+
+  //Map every tile of the image to its index in the shared tileset
+  for(size_t i = 0, k = 0; i < vertical_tiles; i++)
+  {
+    for(size_t j = 0; j < horizontal_tiles; j++, k++)
+    {
+      get_tile_from_png(tile, png_ptr, row_pointers, j, i);
+      palette = tile_palette(tile, bitplane_count);
+      remap[k] = add_tile(set, tile, bitplane_count, dedup, &flags);
+      tilemap_set(map, j, i, remap[k], palette, flags);
+    }
+  }
+
+  return remap;
+}
+
+uint8_t* convert_tileset(const struct tileset* set, unsigned int bitplane_count, unsigned int* data_size)
+{
+  unsigned int bytes_per_tile = 8 * bitplane_count;
+  uint8_t* data;
+
+  *data_size = set->count * bytes_per_tile;
+  data = malloc(*data_size);
+
+  TRACE_PROBE(convert_start, bitplane_count, set->count);
+
+  for(size_t i = 0; i < set->count; i++)
+    convert_to_bitplanes(data + (i * bytes_per_tile), set->tiles + (i * TILE_SIZE), bitplane_count);
+
+  TRACE_PROBE(convert_done, bitplane_count, *data_size);
+
+  return data;
+}
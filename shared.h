@@ -0,0 +1,13 @@
+#ifndef SHARED_H
+#define SHARED_H
+#include <stdint.h>
+
+#include "tilemap.h"
+#include "tileset.h"
+
+void flip_tile(uint8_t* flipped, const uint8_t* tile, uint16_t flags);
+unsigned int add_tile(struct tileset* set, uint8_t* tile, unsigned int bitplane_count, int dedup, uint16_t* flags);
+uint32_t* add_tiles_to_tileset(struct tileset* set, png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int bitplane_count, int dedup, struct tilemap* map, unsigned int* tile_count);
+uint8_t* convert_tileset(const struct tileset* set, unsigned int bitplane_count, unsigned int* data_size);
+
+#endif //SHARED_H
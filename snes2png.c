@@ -0,0 +1,300 @@
+#include <png.h>
+#include <argp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packed.h"
+#include "pngfunctions.h"
+#include "tile.h"
+
+#define OUTPUT 1
+#define CGRAM 2
+#define OFFSET 3
+#define COUNT 4
+
+/* Supplied arguments */
+struct arguments
+{
+  char *input_file;
+  char *output_file;
+  char *cgram_file;
+  int bitplanes;
+  int tilesize;
+  int columns;
+  int palette;
+  long offset;
+  int count;
+};
+
+/* Version and bugs address */
+const char *argp_program_version = "snes2png beta";
+const char *argp_program_bug_address = "<tommy.savaria@protonmail.ch>";
+
+/* Program documentation. */
+static char doc[] = "snes2png -- Create PNG files from SNES Graphics";
+
+/* A description of the arguments we accept. */
+static char args_doc[] = "INPUT_FILE";
+
+/* The options we understand. */
+static struct argp_option options[] = {
+  {"output", 'o', "FILE", 0, "PNG file to write" },
+  {"bitplanes", 'b', "PLANES", 0, "Number of bitplanes per tile (2,4 or 8, or 1 and 3 for packed tiles)"},
+  {"tilesize", 't', "SIZE", 0, "Size of tiles (8x8 or 16x16 VRAM layout)"},
+  {"columns", 'w', "TILES", 0, "Tiles per row of the image (defaults to 16 8x8 tiles or 8 16x16 tiles)"},
+  {"cgram", 'c', "FILE", 0, "Binary palette (.cgr) to use instead of a gray ramp"},
+  {"palette", 'p', "NUMBER", 0, "Sub-palette of the palette used by the tiles"},
+  {"offset", OFFSET, "BYTES", 0, "Position of the first tile in the input, to extract from a ROM"},
+  {"count", COUNT, "TILES", 0, "Number of 8x8 characters to read (defaults to the whole input)"},
+  { 0 }
+};
+
+/* Parse a single option. */
+error_t parse_opt (int key, char *arg, struct argp_state *state)
+{
+  struct arguments *arguments = state->input;
+  char* endptr;
+
+  switch (key)
+    {
+    case 'o':
+      arguments->output_file = arg;
+      break;
+    case 'c':
+      arguments->cgram_file = arg;
+      break;
+    case 'b':
+      arguments->bitplanes = strtol(arg, &endptr, 0);
+      if(*endptr != '\0' || arguments->bitplanes < 1 || arguments->bitplanes > 8 || (arguments->bitplanes > 4 && arguments->bitplanes != 8))
+      {
+        fprintf(stderr, "Invalid value for bitplanes: %s (Possible values are 1, 2, 3, 4 and 8)\n", arg);
+        argp_usage(state);
+        return EINVAL;
+      }
+      break;
+    case 't':
+      arguments->tilesize = strtol(arg, &endptr, 0);
+      if(*endptr != '\0' || (arguments->tilesize != 8 && arguments->tilesize != 16))
+      {
+        fprintf(stderr, "Invalid value for tilesize: %s (Possible values are 8 and 16)\n", arg);
+        argp_usage(state);
+        return EINVAL;
+      }
+      break;
+    case 'w':
+      arguments->columns = strtol(arg, &endptr, 0);
+      if(*endptr != '\0' || arguments->columns <= 0)
+      {
+        fprintf(stderr, "Invalid value for columns: %s\n", arg);
+        argp_usage(state);
+        return EINVAL;
+      }
+      break;
+    case 'p':
+      arguments->palette = strtol(arg, &endptr, 0);
+      if(*endptr != '\0' || arguments->palette < 0)
+      {
+        fprintf(stderr, "Invalid value for palette: %s\n", arg);
+        argp_usage(state);
+        return EINVAL;
+      }
+      break;
+    case OFFSET:
+      arguments->offset = strtol(arg, &endptr, 0);
+      if(*endptr != '\0' || arguments->offset < 0)
+      {
+        fprintf(stderr, "Invalid value for offset: %s\n", arg);
+        argp_usage(state);
+        return EINVAL;
+      }
+      break;
+    case COUNT:
+      arguments->count = strtol(arg, &endptr, 0);
+      if(*endptr != '\0' || arguments->count <= 0)
+      {
+        fprintf(stderr, "Invalid value for count: %s\n", arg);
+        argp_usage(state);
+        return EINVAL;
+      }
+      break;
+    case ARGP_KEY_ARG:
+      if (state->arg_num >= 1)
+      {
+        /* Too many arguments. */
+        argp_usage (state);
+        return EINVAL;
+      }
+      arguments->input_file = arg;
+      break;
+    case ARGP_KEY_END:
+      if (state->arg_num < 1 || !arguments->output_file)
+      {
+        /* Not enough arguments. */
+        argp_usage (state);
+        return EINVAL;
+      }
+      break;
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+/* Our argp parser. */
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+uint8_t* read_file(char* filename, long offset, long* size)
+{
+  uint8_t* data;
+  FILE* fp = fopen(filename, "rb");
+
+  if(!fp)
+  {
+    perror(filename);
+    return NULL;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  *size = ftell(fp) - offset;
+
+  if(*size < 0 || fseek(fp, offset, SEEK_SET) != 0)
+  {
+    fprintf(stderr, "Offset is past the end of %s\n", filename);
+    fclose(fp);
+    return NULL;
+  }
+
+  data = malloc(*size);
+  *size = fread(data, 1, *size, fp);
+  fclose(fp);
+
+  return data;
+}
+
+//Characters of the 16x16 tile at the given position in the VRAM layout
+unsigned int character_number(unsigned int tile, unsigned int tilesize, unsigned int subtile)
+{
+  if(tilesize == 8)
+    return tile;
+
+  return (((tile & 0x07) << 1) | ((tile & ~0x07) << 2)) + ((subtile & 1) | ((subtile & 2) << 3));
+}
+
+int main(int argc, char *argv[])
+{
+  int exit_code = -1;
+  struct arguments args = { NULL, NULL, NULL, 4, 8, 0, 0, 0, 0 };
+  unsigned int bytes_per_tile, character_count, tile_count, columns, rows, width, height, subtiles, colors;
+  uint16_t palette[256];
+  uint8_t tile[TILE_SIZE];
+  uint8_t *data, *cgram = NULL;
+  png_bytepp row_pointers;
+  long size, cgram_size = 0;
+
+  argp_parse (&argp, argc, argv, 0, 0, &args);
+
+  data = read_file(args.input_file, args.offset, &size);
+  if(!data)
+    return -1;
+
+  //Packed tiles are expanded first
+  if(args.bitplanes == 1 || args.bitplanes == 3)
+  {
+    uint8_t* packed = data;
+
+    args.bitplanes++;
+    character_count = size / PACKED_TILE_SIZE(args.bitplanes);
+    size = character_count * 8 * args.bitplanes;
+    data = malloc(size);
+    unpack_tiles(data, packed, character_count, args.bitplanes);
+    free(packed);
+  }
+
+  bytes_per_tile = 8 * args.bitplanes;
+  character_count = size / bytes_per_tile;
+  if(args.count && args.count < character_count)
+    character_count = args.count;
+
+  //16x16 tiles take two rows of 16 characters for every 8 tiles
+  subtiles = args.tilesize == 16 ? 4 : 1;
+  tile_count = args.tilesize == 16 ? ((character_count / 32) * 8) + ((character_count % 32) > 16 ? (character_count % 32) - 16 : 0) / 2 : character_count;
+
+  columns = args.columns ? args.columns : 128 / args.tilesize;
+  rows = (tile_count + columns - 1) / columns;
+  width = columns * args.tilesize;
+  height = rows * args.tilesize;
+
+  if(tile_count == 0)
+  {
+    fprintf(stderr, "%s does not contain a whole tile\n", args.input_file);
+    goto free_data;
+  }
+
+  //Without a palette, show the indices as a gray ramp
+  memset(palette, 0, sizeof(palette));
+  colors = 1 << args.bitplanes;
+
+  if(args.cgram_file)
+  {
+    cgram = read_file(args.cgram_file, 0, &cgram_size);
+    if(!cgram)
+      goto free_data;
+
+    for(size_t i = 0; i < cgram_size / 2 && i < 256; i++)
+      palette[i] = cgram[2*i] | (cgram[(2*i) + 1] << 8);
+
+    if(args.bitplanes < 8)
+      colors = (args.palette + 1) << args.bitplanes;
+    if(colors > 256)
+    {
+      fprintf(stderr, "Palette %d is outside of CGRAM\n", args.palette);
+      goto free_data;
+    }
+  }
+  else
+  {
+    for(size_t i = 0; i < colors; i++)
+    {
+      unsigned int level = (i * 31) / (colors - 1);
+      palette[i] = (level << 10) | (level << 5) | level;
+    }
+
+    args.palette = 0;
+  }
+
+  row_pointers = malloc(height * sizeof(png_bytep));
+  for(size_t y = 0; y < height; y++)
+    row_pointers[y] = calloc(width, 1);
+
+  for(size_t k = 0; k < tile_count; k++)
+  {
+    unsigned int x = (k % columns) * args.tilesize, y = (k / columns) * args.tilesize;
+
+    for(size_t s = 0; s < subtiles; s++)
+    {
+      unsigned int character = character_number(k, args.tilesize, s);
+      unsigned int base = args.bitplanes < 8 ? args.palette << args.bitplanes : 0;
+
+      convert_from_bitplanes(tile, data + (character * bytes_per_tile), args.bitplanes);
+
+      for(size_t row = 0; row < 8; row++)
+      {
+        for(size_t pixel = 0; pixel < 8; pixel++)
+          row_pointers[y + row + ((s >> 1) * 8)][x + pixel + ((s & 1) * 8)] = base + tile[(row * 8) + pixel];
+      }
+    }
+  }
+
+  fprintf(stderr, "%u tiles written to %s as %ux%u pixels\n", tile_count, args.output_file, width, height);
+
+  exit_code = write_indexed_png(args.output_file, row_pointers, width, height, palette, colors);
+
+  free_png(row_pointers, height);
+free_data:
+  free(cgram);
+  free(data);
+
+  return exit_code;
+}
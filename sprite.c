@@ -0,0 +1,333 @@
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "output.h"
+#include "sprite.h"
+#include "tile.h"
+#include "tilemap.h"
+
+//Sum of the uncovered cells in [x0, x1) x [y0, y1) from a summed area table
+unsigned int area_sum(const unsigned int* sat, unsigned int columns, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1)
+{
+  unsigned int stride = columns + 1;
+
+  return sat[(y1 * stride) + x1] - sat[(y0 * stride) + x1] - sat[(y1 * stride) + x0] + sat[(y0 * stride) + x0];
+}
+
+void build_area_table(unsigned int* sat, const uint8_t* uncovered, unsigned int columns, unsigned int rows)
+{
+  unsigned int stride = columns + 1;
+
+  memset(sat, 0, stride * sizeof(unsigned int));
+
+  for(size_t y = 0; y < rows; y++)
+  {
+    unsigned int row_sum = 0;
+
+    sat[(y + 1) * stride] = 0;
+    for(size_t x = 0; x < columns; x++)
+    {
+      row_sum += uncovered[(y * columns) + x];
+      sat[((y + 1) * stride) + x + 1] = sat[(y * stride) + x + 1] + row_sum;
+    }
+  }
+}
+
+unsigned int count_square(const uint8_t* uncovered, unsigned int columns, unsigned int rows, unsigned int x, unsigned int y, unsigned int size)
+{
+  unsigned int count = 0;
+
+  for(size_t i = y; i < y + size && i < rows; i++)
+  {
+    for(size_t j = x; j < x + size && j < columns; j++)
+      count += uncovered[(i * columns) + j];
+  }
+
+  return count;
+}
+
+void clear_square(uint8_t* uncovered, unsigned int columns, unsigned int rows, unsigned int x, unsigned int y, unsigned int size)
+{
+  for(size_t i = y; i < y + size && i < rows; i++)
+  {
+    for(size_t j = x; j < x + size && j < columns; j++)
+      uncovered[(i * columns) + j] = 0;
+  }
+}
+
+//Cover every occupied cell with squares of small_cells or large_cells cells.
+//Large squares are placed greedily where they save at least one small
+//square, the remaining cells are covered with small squares. Squares may
+//extend past the right and bottom edges. Returns the number of squares.
+unsigned int find_obj_cover(const uint8_t* occupied, unsigned int columns, unsigned int rows, unsigned int small_cells, unsigned int large_cells, struct obj_cover* cover)
+{
+  unsigned int count = 0;
+  uint8_t* uncovered = malloc(columns * rows);
+  unsigned int* sat = malloc((columns + 1) * (rows + 1) * sizeof(unsigned int));
+
+  memcpy(uncovered, occupied, columns * rows);
+
+  while(large_cells > small_cells)
+  {
+    unsigned int best_gain = 0, best_x = 0, best_y = 0;
+
+    build_area_table(sat, uncovered, columns, rows);
+
+    for(unsigned int y = 0; y < rows; y++)
+    {
+      unsigned int y1 = y + large_cells < rows ? y + large_cells : rows;
+
+      for(unsigned int x = 0; x < columns; x++)
+      {
+        unsigned int x1 = x + large_cells < columns ? x + large_cells : columns;
+        unsigned int gain = area_sum(sat, columns, x, y, x1, y1);
+
+        if(gain > best_gain)
+        {
+          best_gain = gain;
+          best_x = x;
+          best_y = y;
+        }
+      }
+    }
+
+    //More cells than a small square holds always need two small squares
+    if(best_gain <= small_cells * small_cells)
+      break;
+
+    cover[count].x = best_x;
+    cover[count].y = best_y;
+    cover[count++].large = 1;
+    clear_square(uncovered, columns, rows, best_x, best_y, large_cells);
+  }
+
+  //Place small squares on the first uncovered cell, at the offset covering
+  //the most other cells
+  for(unsigned int y = 0; y < rows; y++)
+  {
+    for(unsigned int x = 0; x < columns; x++)
+    {
+      unsigned int best_gain = 0, best_x = x, best_y = y;
+
+      if(!uncovered[(y * columns) + x])
+        continue;
+
+      //Earlier rows and cells are covered already, only look left on this row
+      for(unsigned int dx = 0; dx < small_cells && dx <= x; dx++)
+      {
+        unsigned int gain = count_square(uncovered, columns, rows, x - dx, y, small_cells);
+
+        if(gain > best_gain)
+        {
+          best_gain = gain;
+          best_x = x - dx;
+          best_y = y;
+        }
+      }
+
+      cover[count].x = best_x;
+      cover[count].y = best_y;
+      cover[count++].large = 0;
+      clear_square(uncovered, columns, rows, best_x, best_y, small_cells);
+    }
+  }
+
+  free(sat);
+  free(uncovered);
+
+  return count;
+}
+
+//Find a free size x size block of characters in the OBJ name table, which is
+//16 characters wide. Blocks are aligned on their size so they never wrap.
+unsigned int allocate_characters(uint8_t** used, unsigned int* used_rows, unsigned int size)
+{
+  for(unsigned int row = 0; ; row++)
+  {
+    for(unsigned int column = 0; column + size <= OBJ_NAME_COLUMNS; column += size)
+    {
+      int free_block = 1;
+
+      if(row + size > *used_rows)
+      {
+        *used = realloc(*used, (row + size) * OBJ_NAME_COLUMNS);
+        memset(*used + (*used_rows * OBJ_NAME_COLUMNS), 0, (row + size - *used_rows) * OBJ_NAME_COLUMNS);
+        *used_rows = row + size;
+      }
+
+      for(unsigned int i = 0; i < size && free_block; i++)
+      {
+        for(unsigned int j = 0; j < size && free_block; j++)
+          free_block = !(*used)[((row + i) * OBJ_NAME_COLUMNS) + column + j];
+      }
+
+      if(!free_block)
+        continue;
+
+      for(unsigned int i = 0; i < size; i++)
+        memset(*used + ((row + i) * OBJ_NAME_COLUMNS) + column, 1, size);
+
+      return (row * OBJ_NAME_COLUMNS) + column;
+    }
+  }
+}
+
+//Slice every frame of the sheet into OBJs, skipping empty 8x8 tiles. The
+//character data is laid out in the OBJ name table order.
+uint8_t* convert_sprites(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int bitplane_count, unsigned int frame_width, unsigned int frame_height, unsigned int small_size, unsigned int large_size, struct metasprite** metasprites, unsigned int* frame_count, unsigned int* data_size)
+{
+  unsigned int height = png_get_image_height(png_ptr, info_ptr);
+  unsigned int width = png_get_image_width(png_ptr, info_ptr);
+  unsigned int columns = frame_width / 8, rows = frame_height / 8;
+  unsigned int frames_across = width / frame_width, frames_down = height / frame_height;
+  unsigned int small_cells = small_size / 8, large_cells = large_size / 8;
+  unsigned int bytes_per_tile = 8 * bitplane_count;
+  unsigned int used_rows = 0, character_count = 0;
+  uint8_t *used = NULL, *data = NULL, *tiles, *occupied;
+  struct obj_cover* cover;
+
+  *frame_count = frames_across * frames_down;
+  *metasprites = calloc(*frame_count, sizeof(struct metasprite));
+
+  tiles = malloc(columns * rows * TILE_SIZE);
+  occupied = malloc(columns * rows);
+  cover = malloc(columns * rows * sizeof(struct obj_cover));
+
+  for(unsigned int frame = 0; frame < *frame_count; frame++)
+  {
+    struct metasprite* metasprite = &(*metasprites)[frame];
+    unsigned int frame_x = (frame % frames_across) * columns;
+    unsigned int frame_y = (frame / frames_across) * rows;
+
+    //Find empty tiles, all color 0
+    for(unsigned int i = 0; i < rows; i++)
+    {
+      for(unsigned int j = 0; j < columns; j++)
+      {
+        uint8_t* tile = tiles + (((i * columns) + j) * TILE_SIZE);
+
+        get_tile_from_png(tile, png_ptr, row_pointers, frame_x + j, frame_y + i);
+
+        occupied[(i * columns) + j] = 0;
+        for(size_t k = 0; k < TILE_SIZE; k++)
+          occupied[(i * columns) + j] |= tile[k] != 0;
+      }
+    }
+
+    metasprite->count = find_obj_cover(occupied, columns, rows, small_cells, large_cells, cover);
+    metasprite->entries = malloc(metasprite->count * sizeof(struct metasprite_entry));
+
+    for(unsigned int k = 0; k < metasprite->count; k++)
+    {
+      struct metasprite_entry* entry = &metasprite->entries[k];
+      unsigned int size = cover[k].large ? large_cells : small_cells;
+      unsigned int first = allocate_characters(&used, &used_rows, size);
+
+      entry->x = cover[k].x * 8;
+      entry->y = cover[k].y * 8;
+      entry->tile = first;
+      entry->large = cover[k].large;
+      entry->palette = 0;
+
+      if((used_rows * OBJ_NAME_COLUMNS) > character_count)
+      {
+        data = realloc(data, used_rows * OBJ_NAME_COLUMNS * bytes_per_tile);
+        memset(data + (character_count * bytes_per_tile), 0, ((used_rows * OBJ_NAME_COLUMNS) - character_count) * bytes_per_tile);
+        character_count = used_rows * OBJ_NAME_COLUMNS;
+      }
+
+      //Cells past the edge of the frame are transparent
+      for(unsigned int i = 0; i < size; i++)
+      {
+        for(unsigned int j = 0; j < size; j++)
+        {
+          unsigned int x = cover[k].x + j, y = cover[k].y + i;
+          unsigned int character = first + (i * OBJ_NAME_COLUMNS) + j;
+
+          if(x >= columns || y >= rows)
+            continue;
+
+          convert_to_bitplanes(data + (character * bytes_per_tile), tiles + (((y * columns) + x) * TILE_SIZE), bitplane_count);
+
+          if(tile_palette(tiles + (((y * columns) + x) * TILE_SIZE), bitplane_count) > entry->palette)
+            entry->palette = tile_palette(tiles + (((y * columns) + x) * TILE_SIZE), bitplane_count);
+        }
+      }
+    }
+  }
+
+  //Trim the name table after the last used character
+  while(character_count > 0 && !used[character_count - 1])
+    character_count--;
+
+  *data_size = character_count * bytes_per_tile;
+
+  free(cover);
+  free(occupied);
+  free(tiles);
+  free(used);
+
+  return data;
+}
+
+void free_metasprites(struct metasprite* metasprites, unsigned int frame_count)
+{
+  for(size_t i = 0; i < frame_count; i++)
+    free(metasprites[i].entries);
+  free(metasprites);
+}
+
+//Every frame is a count byte followed by five bytes per OBJ: X and Y offsets,
+//character number, attributes (0000pppN, only the palette and the top bit
+//of the character number) and size (1 for large)
+void output_metasprites_binary(char* basename, struct metasprite* metasprites, unsigned int frame_count)
+{
+  FILE* fp = open_output(basename, ".spr", 1);
+
+  if(!fp)
+    return;
+
+  for(size_t i = 0; i < frame_count; i++)
+  {
+    putc(metasprites[i].count, fp);
+
+    for(size_t j = 0; j < metasprites[i].count; j++)
+    {
+      struct metasprite_entry* entry = &metasprites[i].entries[j];
+
+      putc(entry->x & 0xFF, fp);
+      putc(entry->y & 0xFF, fp);
+      putc(entry->tile & 0xFF, fp);
+      putc(((entry->palette & 0x07) << 1) | ((entry->tile >> 8) & 0x01), fp);
+      putc(entry->large, fp);
+    }
+  }
+
+  close_output(fp);
+}
+
+void output_metasprites_wla(char* basename, struct metasprite* metasprites, unsigned int frame_count)
+{
+  FILE* fp = open_output(basename, "_sprites.asm", 0);
+
+  if(!fp)
+    return;
+
+  for(size_t i = 0; i < frame_count; i++)
+  {
+    fprintf(fp, "\n; Frame %lu\n\t.db %u\n", i, metasprites[i].count);
+
+    for(size_t j = 0; j < metasprites[i].count; j++)
+    {
+      struct metasprite_entry* entry = &metasprites[i].entries[j];
+
+      fprintf(fp, "\t.db $%02X, $%02X, $%02X, $%02X, %d\n", entry->x & 0xFF, entry->y & 0xFF, entry->tile & 0xFF,
+        ((entry->palette & 0x07) << 1) | ((entry->tile >> 8) & 0x01), entry->large);
+    }
+  }
+
+  close_output(fp);
+}
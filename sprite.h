@@ -0,0 +1,40 @@
+#ifndef SPRITE_H
+#define SPRITE_H
+#include <stdint.h>
+
+/* One OBJ of a metasprite, relative to the top left corner of its frame */
+struct metasprite_entry
+{
+  int x;
+  int y;
+  unsigned int tile;
+  unsigned int palette;
+  int large;
+};
+
+struct metasprite
+{
+  struct metasprite_entry* entries;
+  unsigned int count;
+};
+
+/* Square that covers part of a frame, in 8x8 cells */
+struct obj_cover
+{
+  unsigned int x;
+  unsigned int y;
+  int large;
+};
+
+unsigned int find_obj_cover(const uint8_t* occupied, unsigned int columns, unsigned int rows, unsigned int small_cells, unsigned int large_cells, struct obj_cover* cover);
+uint8_t* convert_sprites(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int bitplane_count, unsigned int frame_width, unsigned int frame_height, unsigned int small_size, unsigned int large_size, struct metasprite** metasprites, unsigned int* frame_count, unsigned int* data_size);
+void free_metasprites(struct metasprite* metasprites, unsigned int frame_count);
+void output_metasprites_binary(char* basename, struct metasprite* metasprites, unsigned int frame_count);
+void output_metasprites_wla(char* basename, struct metasprite* metasprites, unsigned int frame_count);
+
+#define OBJ_NAME_COLUMNS 16
+#define OBJ_MAX_TILES 512
+#define OBJ_MAX_COUNT 128
+#define OBJ_MAX_FRAME_SIZE 256
+
+#endif //SPRITE_H
@@ -3,21 +3,54 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 //#include "argparser.h"
 //#include "main.h"
 //#include "palette.h"
+#include "bitmap.h"
+#include "cgram.h"
+#include "direct.h"
+#include "gradient.h"
+#include "layers.h"
+#include "packed.h"
+#include "palette.h"
 #include "pngfunctions.h"
+#include "reduce.h"
+#include "rom.h"
+#include "shared.h"
+#include "sprite.h"
 #include "tile.h"
+#include "tilemap.h"
+#include "tileset.h"
 
 uint8_t* get_tile_from_png(uint8_t* destination, png_structp png_ptr, png_bytepp row_pointers, int x, int y);
 void convert_to_bitplanes(uint8_t* destination, const uint8_t* source, int bitplane_count);
+void convert_from_bitplanes(uint8_t* destination, const uint8_t* source, int bitplane_count);
+void add_write(struct gradient* gradient, unsigned int slot, unsigned int channel, uint16_t color);
 
 //Tests
 int testGetTileFromPNG();
 int testConvert0sto2Bitplanes();
 int testConvert3sto2Bitplanes();
 int testConvertTo2Bitplanes();
+int testTilesetDeduplication();
+int testTilemapScreenLayout();
+int testDirectColorLookup();
+int testObjCover();
+int testSubpalettePacking();
+int testBitplaneRoundTrip();
+int testPackedTiles();
+int testPaletteInvariantDedup();
+int testLayerSplit();
+int testTileReduction();
+int testRomOffset();
+int testRomChecksum();
+int testPaletteOptimization();
+int testGradientBand();
+int testGradientHdmaTables();
+int testSuperFXColumns();
+int testLinearBitmap();
 
 
 struct unit_test_t {
@@ -30,6 +63,23 @@ struct unit_test_t unitTests[] = {
   {"Convert 0s to 2 bitplanes", testConvert0sto2Bitplanes},
   {"Convert 3s to 2 bitplanes", testConvert3sto2Bitplanes},
   {"Convert Array to 2 bitplanes", testConvertTo2Bitplanes},
+  {"Tileset deduplication", testTilesetDeduplication},
+  {"Tilemap screen layout", testTilemapScreenLayout},
+  {"Direct color lookup", testDirectColorLookup},
+  {"OBJ cover", testObjCover},
+  {"Sub-palette packing", testSubpalettePacking},
+  {"Bitplane round trip", testBitplaneRoundTrip},
+  {"Packed 3bpp tiles", testPackedTiles},
+  {"Palette invariant deduplication", testPaletteInvariantDedup},
+  {"Two layer split", testLayerSplit},
+  {"Tile reduction", testTileReduction},
+  {"ROM offsets", testRomOffset},
+  {"ROM checksum", testRomChecksum},
+  {"Palette optimization", testPaletteOptimization},
+  {"Gradient band", testGradientBand},
+  {"Gradient HDMA tables", testGradientHdmaTables},
+  {"Super FX columns", testSuperFXColumns},
+  {"Linear bitmap", testLinearBitmap},
   {NULL, NULL}
 };
 
@@ -213,3 +263,597 @@ int testConvertTo2Bitplanes() {
 
   return 0;
 }
+
+int testTilesetDeduplication() {
+  uint8_t tile[TILE_SIZE];
+  struct tileset set;
+  unsigned int i, index;
+  int exit_code = 0;
+
+  tileset_init(&set);
+
+  //Enough distinct tiles to grow the table a few times
+  for(i = 0; i < 1000; i++) {
+    memset(tile, 0, TILE_SIZE);
+    tile[i % TILE_SIZE] = (i / TILE_SIZE) + 1;
+
+    if(tileset_add(&set, tile) != i) {
+      printf("Tile %u was not added as a new tile\n", i);
+      exit_code = 1;
+    }
+  }
+
+  //Adding them again must return the same indices
+  for(i = 0; i < 1000; i++) {
+    memset(tile, 0, TILE_SIZE);
+    tile[i % TILE_SIZE] = (i / TILE_SIZE) + 1;
+    index = tileset_add(&set, tile);
+
+    if(index != i) {
+      printf("Expected tile %u, got %u\n", i, index);
+      exit_code = 1;
+    }
+  }
+
+  if(set.count != 1000) {
+    printf("Expected 1000 unique tiles, got %u\n", set.count);
+    exit_code = 1;
+  }
+
+  tileset_free(&set);
+  return exit_code;
+}
+
+int testTilemapScreenLayout() {
+  struct tilemap map;
+  int exit_code = 0;
+
+  //Each 32x32 screen is stored after the previous one
+  const unsigned int coordinates[][3] = {{0, 0, 0},
+                                         {31, 0, 31},
+                                         {0, 1, 32},
+                                         {32, 0, 1024},
+                                         {0, 32, 2048},
+                                         {33, 33, 3105},
+                                         {63, 63, 4095}};
+
+  tilemap_init(&map, 64, 64, 0x100, 1);
+
+  for(size_t i = 0; i < sizeof(coordinates) / sizeof(coordinates[0]); i++) {
+    unsigned int index = tilemap_index(&map, coordinates[i][0], coordinates[i][1]);
+
+    if(index != coordinates[i][2]) {
+      printf("Expected (%u, %u) at %u, got %u\n", coordinates[i][0], coordinates[i][1], coordinates[i][2], index);
+      exit_code = 1;
+    }
+  }
+
+  //Entries hold the tile number, palette and priority
+  tilemap_set(&map, 32, 0, 0x0FF, 5, TILEMAP_HFLIP);
+  if(map.entries[1024] != 0x75FF) {
+    printf("Expected entry $75FF, got $%04X\n", map.entries[1024]);
+    exit_code = 1;
+  }
+
+  tilemap_free(&map);
+  return exit_code;
+}
+
+int testDirectColorLookup() {
+  unsigned int palette_bits, color;
+
+  //Every color reachable in direct color mode must map back to itself
+  for(palette_bits = 0; palette_bits < DIRECT_COLOR_PALETTES; palette_bits++) {
+    const uint8_t* lut = direct_color_lut(palette_bits);
+
+    for(color = 0; color < 256; color++) {
+      uint16_t bgr15 = direct_color_to_bgr15(color, palette_bits);
+
+      if(lut[bgr15] != color) {
+        printf("Expected %02X for $%04X with palette %u, got %02X\n", color, bgr15, palette_bits, lut[bgr15]);
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+int testObjCover() {
+  struct obj_cover cover[16];
+  unsigned int count, large = 0;
+
+  //Opaque 32x32 block with a lone tile under it, 8x8 and 16x16 OBJs
+  const uint8_t occupied[] = {1, 1, 1, 1,
+                              1, 1, 1, 1,
+                              1, 1, 1, 1,
+                              1, 1, 1, 1,
+                              0, 0, 1, 0};
+
+  count = find_obj_cover(occupied, 4, 5, 1, 2, cover);
+
+  for(size_t i = 0; i < count; i++)
+    large += cover[i].large;
+
+  if(count != 5 || large != 4) {
+    printf("Expected 4 large and 1 small OBJs, got %u large and %u small\n", large, count - large);
+    return 1;
+  }
+
+  return 0;
+}
+
+int testSubpalettePacking() {
+  struct subpalette subpalettes[3];
+  uint16_t cgram[CGRAM_COLORS];
+  unsigned int slot_count;
+
+  //Two sub-palettes sharing colors fit one 4bpp slot, the third does not
+  memset(subpalettes, 0, sizeof(subpalettes));
+  for(size_t i = 0; i < 3; i++) {
+    subpalettes[i].number = i;
+    for(size_t j = 1; j < 9; j++) {
+      subpalettes[i].used[j] = 1;
+      subpalettes[i].index_color[j] = i == 2 ? 0x100 + j : (i * 4) + j;
+      subpalettes[i].colors[subpalettes[i].count++] = subpalettes[i].index_color[j];
+    }
+  }
+
+  if(pack_subpalettes(subpalettes, 3, 4, cgram, &slot_count) != 0 || slot_count != 2) {
+    printf("Expected 2 slots\n");
+    return 1;
+  }
+
+  if(subpalettes[0].slot != subpalettes[1].slot || subpalettes[1].remap[1] != 5 || cgram[subpalettes[2].slot * 16 + subpalettes[2].remap[3]] != 0x103) {
+    printf("Sub-palettes were not merged\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+int testBitplaneRoundTrip() {
+  uint8_t tile[TILE_SIZE], planes[SUBTILE_SIZE * 4], result[TILE_SIZE];
+
+  for(size_t i = 0; i < TILE_SIZE; i++)
+    tile[i] = (i * 37) ^ (i >> 2);
+
+  convert_to_bitplanes(planes, tile, 8);
+  convert_from_bitplanes(result, planes, 8);
+
+  if(memcmp(tile, result, TILE_SIZE) != 0) {
+    printf("Decoded tile differs from the original\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+int testPackedTiles() {
+  uint8_t tile[TILE_SIZE], planes[SUBTILE_SIZE * 4], packed[SUBTILE_SIZE * 4], result[SUBTILE_SIZE * 4];
+
+  //Two 8 color tiles
+  for(size_t i = 0; i < TILE_SIZE; i++)
+    tile[i] = (i * 5) & 0x07;
+
+  convert_to_bitplanes(planes, tile, 4);
+  convert_to_bitplanes(planes + (SUBTILE_SIZE * 2), tile, 4);
+  memcpy(packed, planes, sizeof(planes));
+
+  if(pack_tiles(packed, SUBTILE_SIZE * 4, 4) != 48) {
+    printf("Expected 24 bytes per packed tile\n");
+    return 1;
+  }
+
+  unpack_tiles(result, packed, 2, 4);
+
+  if(memcmp(planes, result, SUBTILE_SIZE * 4) != 0) {
+    printf("Unpacked tiles differ from the original\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+int testPaletteInvariantDedup() {
+  uint8_t tile[TILE_SIZE], recolored[TILE_SIZE], flipped[TILE_SIZE];
+  struct tileset set;
+  uint16_t flags;
+  int exit_code = 0;
+
+  for(size_t i = 0; i < TILE_SIZE; i++)
+    tile[i] = (i * 7) & 0x0F;
+
+  //Same shape in sub-palette 3, flipped both ways
+  for(size_t i = 0; i < TILE_SIZE; i++)
+    recolored[i] = tile[i] | 0x30;
+  flip_tile(flipped, recolored, TILEMAP_HFLIP | TILEMAP_VFLIP);
+
+  tileset_init(&set);
+  add_tile(&set, tile, 4, DEDUP_PALETTE | DEDUP_FLIP, &flags);
+
+  if(add_tile(&set, recolored, 4, DEDUP_PALETTE, &flags) != 0 || flags != 0) {
+    printf("Recolored tile was not matched\n");
+    exit_code = 1;
+  }
+
+  if(add_tile(&set, flipped, 4, DEDUP_PALETTE | DEDUP_FLIP, &flags) != 0 || flags != (TILEMAP_HFLIP | TILEMAP_VFLIP)) {
+    printf("Flipped tile was not matched\n");
+    exit_code = 1;
+  }
+
+  if(set.count != 1) {
+    printf("Expected 1 unique tile, got %u\n", set.count);
+    exit_code = 1;
+  }
+
+  tileset_free(&set);
+  return exit_code;
+}
+
+int testLayerSplit() {
+  uint8_t tiles[TILE_SIZE * 2], front[TILE_SIZE * 2], back[TILE_SIZE * 2];
+  struct layer_split splits[2];
+  uint16_t palette[256];
+
+  for(size_t i = 0; i < 256; i++)
+    palette[i] = i;
+
+  //First tile uses sub-palettes 0 and 1, the second one also uses 2.
+  //Color 0 of a sub-palette cannot be drawn, so the indices are odd.
+  for(size_t i = 0; i < TILE_SIZE; i++) {
+    tiles[i] = (i % 32) | 1;
+    tiles[TILE_SIZE + i] = (i % 48) | 1;
+  }
+
+  if(split_layers(tiles, 2, palette, 256, front, back, splits) != 1 || splits[0].conflicts != 0 || splits[1].conflicts == 0) {
+    printf("Expected the second tile only to conflict\n");
+    return 1;
+  }
+
+  //Overlaying the layers gives the original tile back
+  for(size_t i = 0; i < TILE_SIZE; i++) {
+    unsigned int color = front[i] ? (splits[0].front_palette * 16) + front[i] : (back[i] ? (splits[0].back_palette * 16) + back[i] : 0);
+
+    if(color != tiles[i]) {
+      printf("Pixel %lu is %u instead of %u\n", i, color, tiles[i]);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int testTileReduction() {
+  uint8_t tile[TILE_SIZE];
+  unsigned int occurrences[] = {5, 1, 5};
+  unsigned int mapping[3];
+  uint16_t palette[4] = {0x0000, 0x0421, 0x0000, 0x7FFF};
+  struct reduction_error error;
+  struct tileset set;
+  int exit_code = 0;
+
+  //A black tile, the same with one dark pixel, and a white tile
+  tileset_init(&set);
+  memset(tile, 0, TILE_SIZE);
+  tileset_add(&set, tile);
+  tile[27] = 1;
+  tileset_add(&set, tile);
+  memset(tile, 3, TILE_SIZE);
+  tileset_add(&set, tile);
+
+  if(reduce_tileset(&set, occurrences, palette, 2, mapping, &error) != 2 || set.count != 2) {
+    printf("Expected 2 tiles, got %u\n", set.count);
+    tileset_free(&set);
+    return 1;
+  }
+
+  //The dark pixel is dropped, the white tile is kept
+  if(mapping[0] != mapping[1] || mapping[2] == mapping[0] || set.tiles[(mapping[1] * TILE_SIZE) + 27] != 0) {
+    printf("Expected the second tile to map to the black tile\n");
+    exit_code = 1;
+  }
+
+  if(error.changed_tiles != 1 || error.max_tile_error == 0 || error.mean_pixel_error <= 0) {
+    printf("Expected 1 changed tile, got %u with a worst error of %u\n", error.changed_tiles, error.max_tile_error);
+    exit_code = 1;
+  }
+
+  tileset_free(&set);
+  return exit_code;
+}
+
+//Open a temporary ROM holding the given bytes, removed once mapped
+int open_test_rom(const uint8_t* data, size_t size, const char* address) {
+  char filename[] = "/tmp/png2snes_romXXXXXX";
+  char* spec;
+  int fd = mkstemp(filename), result;
+
+  if(fd < 0 || write(fd, data, size) != size) {
+    printf("Cannot write %s\n", filename);
+    return -1;
+  }
+
+  close(fd);
+  if(asprintf(&spec, "%s@%s", filename, address) == -1)
+    return -1;
+
+  result = rom_open(spec, 0, 0, 0);
+  unlink(filename);
+  free(spec);
+
+  return result;
+}
+
+int checkRomOffsets(const long offsets[][2], size_t count, const char* mapping) {
+  int exit_code = 0;
+
+  for(size_t i = 0; i < count; i++) {
+    if(rom_offset(offsets[i][0]) != offsets[i][1]) {
+      printf("Expected %s $%06lX at %ld, got %ld\n", mapping, offsets[i][0], offsets[i][1], rom_offset(offsets[i][0]));
+      exit_code = 1;
+    }
+  }
+
+  return exit_code;
+}
+
+int testRomOffset() {
+  uint8_t* data = calloc(0x10000, 1);
+  int exit_code = 0;
+
+  //Banks $7E and $7F are WRAM, $FE and $FF mirror the last ROM banks
+  const long lorom[][2] = {{0x008000, 0x0000},
+                           {0x018000, 0x8000},
+                           {0x808000, 0x0000},
+                           {0x002000, -1},
+                           {0x7E8000, -1},
+                           {0x7F8000, -1},
+                           {0xFE8000, 0x3F0000},
+                           {0xFF8000, 0x3F8000}};
+
+  const long hirom[][2] = {{0xC01234, 0x001234},
+                           {0x400000, 0x000000},
+                           {0x008000, 0x008000},
+                           {0x002000, -1},
+                           {0x7E0000, -1},
+                           {0x7F8000, -1},
+                           {0xFE0000, 0x3E0000},
+                           {0xFF8000, 0x3F8000}};
+
+  //Without a valid header the ROM is LoROM
+  if(open_test_rom(data, 0x10000, "$008000") != 0) {
+    free(data);
+    return 1;
+  }
+
+  exit_code |= checkRomOffsets(lorom, sizeof(lorom) / sizeof(lorom[0]), "LoROM");
+  rom_close();
+
+  //HiROM map mode with a checksum matching its complement
+  data[ROM_HIROM_HEADER + 0x15] = 0x21;
+  data[ROM_HIROM_HEADER + 0x1C] = 0xFF;
+  data[ROM_HIROM_HEADER + 0x1D] = 0xFF;
+
+  if(open_test_rom(data, 0x10000, "$C00000") != 0) {
+    free(data);
+    return 1;
+  }
+
+  exit_code |= checkRomOffsets(hirom, sizeof(hirom) / sizeof(hirom[0]), "HiROM");
+  rom_close();
+
+  free(data);
+  return exit_code;
+}
+
+int testRomChecksum() {
+  uint8_t* data = calloc(0x18000, 1);
+  uint16_t checksum;
+
+  //The 32 KiB past the first 64 KiB are counted twice to fill 128 KiB
+  data[0x0000] = 0x10;
+  data[0x7FFF] = 0x20;
+  data[0x10000] = 0x03;
+
+  if(open_test_rom(data, 0x18000, "$008000") != 0) {
+    free(data);
+    return 1;
+  }
+
+  checksum = rom_checksum();
+  rom_close();
+  free(data);
+
+  if(checksum != 0x36) {
+    printf("Expected checksum $0036, got $%04X\n", checksum);
+    return 1;
+  }
+
+  return 0;
+}
+
+int testPaletteOptimization() {
+  uint8_t row0[] = {0, 3, 5, 7}, row1[] = {7, 5, 3, 0};
+  png_bytep rows[] = {row0, row1};
+  uint16_t palette[256], optimized[256];
+  uint8_t remap[256];
+  unsigned int count;
+
+  for(size_t i = 0; i < 256; i++)
+    palette[i] = i * 3;
+
+  //Entries 3 and 5 are the same color, entry 2 is not used
+  palette[5] = palette[3];
+
+  count = optimize_palette(palette, rows, 4, 2, remap, optimized);
+
+  if(count != 3 || remap[3] != 1 || remap[5] != 1 || remap[7] != 2 || optimized[1] != palette[3] || optimized[2] != palette[7]) {
+    printf("Expected 3 colors with entries 3 and 5 merged, got %u\n", count);
+    return 1;
+  }
+
+  remap_pixels(rows, 4, 2, remap);
+
+  if(row0[1] != 1 || row0[2] != 1 || row0[3] != 2 || row1[0] != 2 || row1[3] != 0) {
+    printf("Pixels were not remapped\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+int testGradientBand() {
+  uint8_t pixels[GRADIENT_BAND_HEIGHT][2];
+  png_bytep rows[GRADIENT_BAND_HEIGHT];
+  uint16_t palette[256] = {0x0000, 0x001F, 0x03E0};
+  struct gradient gradient;
+  int exit_code = 0;
+
+  //One color slot, red for the top half of the band and green below
+  for(size_t y = 0; y < GRADIENT_BAND_HEIGHT; y++) {
+    pixels[y][0] = y < 4 ? 1 : 2;
+    pixels[y][1] = 0;
+    rows[y] = pixels[y];
+  }
+
+  gradient_init(&gradient, 1, 1);
+  gradient_add_band(&gradient, rows, 2, GRADIENT_BAND_HEIGHT, palette);
+
+  if(gradient.conflicts != 0 || gradient.base[1] != 0x001F || gradient.write_count != 1) {
+    printf("Expected red in the base palette and 1 write, got %u writes\n", gradient.write_count);
+    exit_code = 1;
+  }
+  else if(gradient.writes[0].line != 4 || gradient.writes[0].slot != 1 || gradient.writes[0].color != 0x03E0) {
+    printf("Expected green written to slot 1 before line 4, got slot %u before line %u\n", gradient.writes[0].slot, gradient.writes[0].line);
+    exit_code = 1;
+  }
+
+  //Both colors are drawn with the slot, transparent pixels stay 0
+  for(size_t y = 0; y < GRADIENT_BAND_HEIGHT; y++) {
+    if(pixels[y][0] != 1 || pixels[y][1] != 0) {
+      printf("Line %lu was not remapped to slot 1\n", y);
+      exit_code = 1;
+    }
+  }
+
+  gradient_free(&gradient);
+  return exit_code;
+}
+
+int testGradientHdmaTables() {
+  struct gradient gradient;
+  unsigned int size;
+  uint8_t* tables;
+  int exit_code = 0;
+
+  //A write before line 4 of 300, the rest is held in 127 line entries
+  const uint8_t expected[] = {4, 0, 0, 0x00, 0x00,
+                              127, 1, 1, 0xE0, 0x03,
+                              127, 0, 0, 0x00, 0x00,
+                              42, 0, 0, 0x00, 0x00,
+                              0};
+
+  gradient_init(&gradient, 1, 1);
+  gradient.line = 4;
+  add_write(&gradient, 1, 0, 0x03E0);
+  gradient.line = 300;
+
+  tables = gradient_hdma_tables(&gradient, &size);
+
+  if(size != sizeof(expected) || memcmp(tables, expected, size) != 0) {
+    printf("HDMA table of %u bytes differs from the expected %lu bytes\n", size, sizeof(expected));
+    exit_code = 1;
+  }
+
+  free(tables);
+  gradient_free(&gradient);
+  return exit_code;
+}
+
+int testSuperFXColumns() {
+  uint8_t tiles[TILE_SIZE * 4];
+  struct tilemap map;
+  unsigned int data_size;
+  uint8_t* data;
+  int exit_code = 0;
+
+  //2x2 tiles of colors 1, 2, 3 and 0 on a 128 pixel high screen
+  const uint8_t colors[] = {1, 2, 3, 0};
+  const unsigned int characters[] = {0, 16, 1, 17};
+
+  for(size_t k = 0; k < 4; k++)
+    memset(tiles + (k * TILE_SIZE), colors[k], TILE_SIZE);
+
+  tilemap_init(&map, 32, 32, 0, 0);
+  data = convert_superfx(tiles, 2, 2, 2, 128, &map, &data_size);
+
+  //Each column is a run of 16 characters
+  if(!data || data_size != 2 * 16 * 16) {
+    printf("Expected 512 bytes, got %u\n", data ? data_size : 0);
+    tilemap_free(&map);
+    free(data);
+    return 1;
+  }
+
+  for(size_t k = 0; k < 4; k++) {
+    const uint8_t* character = data + (characters[k] * 16);
+
+    for(size_t row = 0; row < 8; row++) {
+      if(character[row * 2] != ((colors[k] & 1) ? 0xFF : 0x00) || character[(row * 2) + 1] != ((colors[k] & 2) ? 0xFF : 0x00)) {
+        printf("Tile %lu is not character %u\n", k, characters[k]);
+        exit_code = 1;
+        break;
+      }
+    }
+
+    if((map.entries[tilemap_index(&map, k % 2, k / 2)] & TILEMAP_TILE_MASK) != characters[k]) {
+      printf("BG map entry of tile %lu does not point to character %u\n", k, characters[k]);
+      exit_code = 1;
+    }
+  }
+
+  //Parts of the screen outside the image stay blank
+  for(size_t i = 2 * 16; i < 16 * 16; i++) {
+    if(data[i] != 0) {
+      printf("Character 2 is not blank\n");
+      exit_code = 1;
+      break;
+    }
+  }
+
+  tilemap_free(&map);
+  free(data);
+  return exit_code;
+}
+
+int testLinearBitmap() {
+  uint8_t row0[] = {1, 2, 3, 0}, row1[] = {3, 3, 3, 3};
+  png_bytep rows[] = {row0, row1};
+  unsigned int data_size;
+  uint8_t* data;
+  int exit_code = 0;
+
+  //Leftmost pixel in the low bits
+  data = convert_linear_bitmap(rows, 4, 2, 2, &data_size);
+  if(!data || data_size != 2 || data[0] != 0x39 || data[1] != 0xFF) {
+    printf("Unexpected 2bpp bitmap\n");
+    exit_code = 1;
+  }
+  free(data);
+
+  data = convert_linear_bitmap(rows, 4, 2, 4, &data_size);
+  if(!data || data_size != 4 || data[0] != 0x21 || data[1] != 0x03 || data[2] != 0x33 || data[3] != 0x33) {
+    printf("Unexpected 4bpp bitmap\n");
+    exit_code = 1;
+  }
+  free(data);
+
+  //Rows must fill whole bytes
+  if(convert_linear_bitmap(rows, 3, 2, 2, &data_size) != NULL) {
+    printf("Expected a 3 pixel wide 2bpp bitmap to be refused\n");
+    exit_code = 1;
+  }
+
+  return exit_code;
+}
@@ -4,34 +4,20 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "output.h"
 #include "tile.h"
+#include "tilemap.h"
+#include "trace.h"
 
 void output_tiles_binary(char* basename, uint8_t* data, int bytes)
 {
-
-  FILE* fp;
-  char* filename;
-
-  if(asprintf(&filename, "%s.vra", basename) == -1)
-  {
-    perror("output_tiles_binary");
-    return;
-  }
-
-  fp = fopen(filename, "wb");
+  FILE* fp = open_output(basename, ".vra", 1);
 
   if(!fp)
-  {
-    perror(filename);
-    free(filename);
     return;
-  }
-
-  for(size_t i = 0; i < bytes; i++)
-    putc(data[i], fp);
 
-  free(filename);
-  fclose(fp);
+  fwrite(data, 1, bytes, fp);
+  close_output(fp);
 }
 
 void output_tiles_wla(char* basename, uint8_t* data, int bytes)
@@ -143,35 +129,69 @@ void convert_to_bitplanes(uint8_t* destination, const uint8_t* source, int bitpl
   }
 }
 
-uint8_t* convert_to_tiles_16_16(png_structp png_ptr, png_infop info_ptr, unsigned int bitplane_count, unsigned int* data_size)
+//Copy every 8x8 tile of the image into one chunky buffer, in raster order,
+//so that several conversions can share a single extraction
+uint8_t* get_tiles_from_png(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int* columns, unsigned int* rows)
+{
+  uint8_t* tiles;
+
+  *columns = png_get_image_width(png_ptr, info_ptr) / 8;
+  *rows = png_get_image_height(png_ptr, info_ptr) / 8;
+  tiles = malloc(*columns * *rows * TILE_SIZE);
+
+  for(size_t i = 0, k = 0; i < *rows; i++)
+  {
+    for(size_t j = 0; j < *columns; j++, k++)
+      get_tile_from_png(tiles + (k * TILE_SIZE), png_ptr, row_pointers, j, i);
+  }
+
+  return tiles;
+}
+
+//Spread the bits of a plane byte to one byte per pixel, leftmost pixel in
+//the lowest byte
+#define SPREAD_BITS(byte) ((((((byte) * 0x0101010101010101ULL) & 0x0102040810204080ULL) + 0x7F7F7F7F7F7F7F7FULL) >> 7) & 0x0101010101010101ULL)
+
+//Inverse of convert_to_bitplanes. A whole row of 8 pixels is assembled at
+//once in a 64-bit word, one pixel per byte.
+void convert_from_bitplanes(uint8_t* destination, const uint8_t* source, int bitplane_count)
+{
+  for(size_t row = 0, offset = 0; row < 8; row++, offset+=2)
+  {
+    uint64_t pixels = 0;
+
+    for(size_t plane = 0; plane < bitplane_count; plane++)
+      pixels |= SPREAD_BITS(source[offset + ((plane >> 1) * SUBTILE_SIZE) + (plane & 1)]) << plane;
+
+    for(size_t pixel = 0; pixel < 8; pixel++)
+      destination[(row * 8) + pixel] = pixels >> (pixel * 8);
+  }
+}
+
+//First character of 16x16 tile k. Rows of 8 tiles take 16 characters
+//across, the bottom halves are the next 16 characters.
+unsigned int tile_16_16_character(unsigned int k)
+{
+  return ((k & 0x07) << 1) | ((k & ~(0x07)) << 2);
+}
+
+uint8_t* convert_to_tiles_16_16(const uint8_t* tiles, unsigned int columns, unsigned int rows, unsigned int bitplane_count, struct tilemap* map, unsigned int* data_size)
 {
   //Keep tracks of outputed bytes
-  //Get image size and bit depth
-  unsigned int height = png_get_image_height(png_ptr, info_ptr);
-  unsigned int width = png_get_image_width(png_ptr, info_ptr);
-  //unsigned int bit_depth = png_get_bit_depth(png_ptr, info_ptr);
-  unsigned int rowbytes = png_get_rowbytes(png_ptr, info_ptr);
-
-  unsigned int horizontal_tiles  = width / 16;
-  unsigned int vertical_tiles = height / 16;
+  unsigned int horizontal_tiles  = columns / 2;
+  unsigned int vertical_tiles = rows / 2;
   unsigned int tile_count = horizontal_tiles * vertical_tiles;
   unsigned int bytes_per_tile = 8 * bitplane_count;
 
-  unsigned int tile_number;
-  uint8_t tile[TILE_SIZE];
+  unsigned int tile_number, palette;
+  const uint8_t* tile;
   uint8_t* data;
 
-  png_bytepp row_pointers = malloc(sizeof(png_bytep) * height);
-  for(size_t i = 0; i < height; i++)
-    row_pointers[i] = malloc(sizeof(png_byte) * rowbytes);
-
-  png_read_image(png_ptr, row_pointers);
-
   //Optimize this calculation. It shouldn't be that complex
   *data_size = ((((tile_count/8) + 1) * 8) + tile_count) * 16 * bitplane_count;
 
-  //Allocate required space
-  data = malloc(*data_size);
+  //Allocate required space, unused characters between rows stay blank
+  data = calloc(*data_size, 1);
 
   //For each tile row
   for(size_t i = 0, k = 0; i < vertical_tiles; i++)
@@ -180,130 +200,94 @@ uint8_t* convert_to_tiles_16_16(png_structp png_ptr, png_infop info_ptr, unsigne
     for(size_t j = 0; j < horizontal_tiles; j++, k++)
     {
       //Tile
-      tile_number = ((k & 0x07) << 1) | ((k & ~(0x07)) << 2);
-      get_tile_from_png(tile, png_ptr, row_pointers, 2*j, 2*i);
+      tile_number = tile_16_16_character(k);
+      tile = tiles + ((((2*i) * columns) + (2*j)) * TILE_SIZE);
       convert_to_bitplanes(data + (tile_number * bytes_per_tile), tile, bitplane_count);
-
-      //print_tile(tile);
-      //print_bitplanes(data + (tile_number * bytes_per_tile));
-      printf("Tile Number = %u\nOffset = %u\n", tile_number, tile_number * bytes_per_tile);
+      palette = tile_palette(tile, bitplane_count);
 
       //Tile + 1
       tile_number += 1;
-      get_tile_from_png(tile, png_ptr, row_pointers, (2*j) + 1, 2*i);
+      tile += TILE_SIZE;
       convert_to_bitplanes(data + (tile_number * bytes_per_tile), tile, bitplane_count);
-
-      //print_tile(tile);
-      //print_bitplanes(data + (tile_number * bytes_per_tile));
-      printf("Tile Number = %u\nOffset = %u\n", tile_number, tile_number * bytes_per_tile);
+      if(tile_palette(tile, bitplane_count) > palette)
+        palette = tile_palette(tile, bitplane_count);
 
       //Tile + 16
       tile_number += 15;
-      get_tile_from_png(tile, png_ptr, row_pointers, 2*j, (2*i) + 1);
+      tile += (columns - 1) * TILE_SIZE;
       convert_to_bitplanes(data + (tile_number * bytes_per_tile), tile, bitplane_count);
-
-      //print_tile(tile);
-      //print_bitplanes(data + (tile_number * bytes_per_tile));
-      printf("Tile Number = %u\nOffset = %u\n", tile_number, tile_number * bytes_per_tile);
+      if(tile_palette(tile, bitplane_count) > palette)
+        palette = tile_palette(tile, bitplane_count);
 
       //Tile + 17
       tile_number += 1;
-      get_tile_from_png(tile, png_ptr, row_pointers, (2*j) + 1, (2*i) + 1);
+      tile += TILE_SIZE;
       convert_to_bitplanes(data + (tile_number * bytes_per_tile), tile, bitplane_count);
+      if(tile_palette(tile, bitplane_count) > palette)
+        palette = tile_palette(tile, bitplane_count);
 
-      //print_tile(tile);
-      //print_bitplanes(data + (tile_number * bytes_per_tile));
-      printf("Tile Number = %u\nOffset = %u\n", tile_number, tile_number * bytes_per_tile);
+      //Map entries point to the top left tile
+      if(map)
+        tilemap_set(map, j, i, tile_number - 17, palette, 0);
     }
   }
 
   return data;
 }
 
-uint8_t* convert_to_tiles_8_8(png_structp png_ptr, png_infop info_ptr, unsigned int bitplane_count, unsigned int* data_size)
+uint8_t* convert_to_tiles_8_8(const uint8_t* tiles, unsigned int columns, unsigned int rows, unsigned int bitplane_count, struct tilemap* map, unsigned int* data_size)
 {
   //Keep tracks of outputed bytes
-  unsigned int height = png_get_image_height(png_ptr, info_ptr);
-  unsigned int width = png_get_image_width(png_ptr, info_ptr);
-  unsigned int rowbytes = png_get_rowbytes(png_ptr, info_ptr);
-  unsigned int horizontal_tiles  = width / 8;
-  unsigned int vertical_tiles = height / 8;
   unsigned int bytes_per_tile = 8 * bitplane_count;
+  uint8_t* data;
 
-  //unsigned int position;
-  uint8_t *tile, *data;
-
-  png_bytepp row_pointers = malloc(sizeof(png_bytep) * height);
-  for(size_t i = 0; i < height; i++)
-    row_pointers[i] = malloc(sizeof(png_byte) * rowbytes);
-
-  png_read_image(png_ptr, row_pointers);
-
-  *data_size = horizontal_tiles * vertical_tiles * 8 * bitplane_count;
+  *data_size = columns * rows * 8 * bitplane_count;
   data = malloc(*data_size);
-  tile = malloc(TILE_SIZE);
 
   //For each tile row
-  for(size_t i = 0, k = 0; i < vertical_tiles; i++)
+  for(size_t i = 0, k = 0; i < rows; i++)
   {
     //For each tile
-    for(size_t j = 0; j < horizontal_tiles; j++, k++)
+    for(size_t j = 0; j < columns; j++, k++)
     {
-      get_tile_from_png(tile, png_ptr, row_pointers, j, i);
-      convert_to_bitplanes(data + (k * bytes_per_tile), tile, bitplane_count);
-    }
-  }
+      convert_to_bitplanes(data + (k * bytes_per_tile), tiles + (k * TILE_SIZE), bitplane_count);
 
-  for (size_t i = 0; i < height; i++)
-  {
-    free(row_pointers[i]);
+      if(map)
+        tilemap_set(map, j, i, k, tile_palette(tiles + (k * TILE_SIZE), bitplane_count), 0);
+    }
   }
 
-  free(row_pointers);
-  free(tile);
   return data;
 }
 
-uint8_t* convert_tiles(png_structp png_ptr, png_infop info_ptr, unsigned int bitplane_count, unsigned int tilesize, unsigned int* data_size)
+uint8_t* convert_chunky_tiles(const uint8_t* tiles, unsigned int columns, unsigned int rows, unsigned int bitplane_count, unsigned int tilesize, struct tilemap* map, unsigned int* data_size)
 {
-  /*
-
-  //Keep tracks of outputed bytes
-  //Get image size and bit depth
-  unsigned int height = png_get_image_height(png_ptr, info_ptr);
-  unsigned int width = png_get_image_width(png_ptr, info_ptr);
-  unsigned int bit_depth = png_get_bit_depth(png_ptr, info_ptr);
-  unsigned int rowbytes = png_get_rowbytes(png_ptr, info_ptr);
-
-  unsigned int horizontal_tiles  = width / tilesize;
-  unsigned int vertical_tiles = height / tilesize;
-  unsigned int tile_count = horizontal_tiles * vertical_tiles;
-  unsigned int bytes_per_tile = 8 * bitplane_count;
-
-
-  png_bytepp row_pointers = malloc(sizeof(png_bytep) * height);
-  for(size_t i = 0; i < height; i++)
-    row_pointers[i] = malloc(sizeof(png_byte) * rowbytes);
-
-  png_read_image(png_ptr, row_pointers);
+  uint8_t* data;
 
-  //For each tile row
-  for(size_t i = 0, k = 0; i < vertical_tiles; i++)
-  {
-    //For each tile
-    for(size_t j = 0; j < horizontal_tiles; j++, k++)
-    {
-      //Convert single tile
-    }
-  }
-  */
+  TRACE_PROBE(convert_start, bitplane_count, tilesize);
 
   if(tilesize == 8)
   {
-    return convert_to_tiles_8_8(png_ptr, info_ptr, bitplane_count, data_size);
+    data = convert_to_tiles_8_8(tiles, columns, rows, bitplane_count, map, data_size);
   }
   else// if(tilesize == 16)
   {
-    return convert_to_tiles_16_16(png_ptr, info_ptr, bitplane_count, data_size);
+    data = convert_to_tiles_16_16(tiles, columns, rows, bitplane_count, map, data_size);
   }
+
+  TRACE_PROBE(convert_done, bitplane_count, *data_size);
+
+  return data;
+}
+
+uint8_t* convert_tiles(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int bitplane_count, unsigned int tilesize, struct tilemap* map, unsigned int* data_size)
+{
+  unsigned int columns, rows;
+  uint8_t *tiles, *data;
+
+  tiles = get_tiles_from_png(png_ptr, info_ptr, row_pointers, &columns, &rows);
+  data = convert_chunky_tiles(tiles, columns, rows, bitplane_count, tilesize, map, data_size);
+
+  free(tiles);
+  return data;
 }
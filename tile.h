@@ -1,7 +1,14 @@
 #ifndef TILE_H
 #define TILE_H
 
-uint8_t* convert_tiles(png_structp png_ptr, png_infop info_ptr, unsigned int bitplane_count, unsigned int tilesize, unsigned int* data_size);
+uint8_t* get_tile_from_png(uint8_t* destination, png_structp png_ptr, png_bytepp row_pointers, int x, int y);
+void convert_to_bitplanes(uint8_t* destination, const uint8_t* source, int bitplane_count);
+void convert_from_bitplanes(uint8_t* destination, const uint8_t* source, int bitplane_count);
+struct tilemap;
+uint8_t* get_tiles_from_png(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int* columns, unsigned int* rows);
+unsigned int tile_16_16_character(unsigned int k);
+uint8_t* convert_chunky_tiles(const uint8_t* tiles, unsigned int columns, unsigned int rows, unsigned int bitplane_count, unsigned int tilesize, struct tilemap* map, unsigned int* data_size);
+uint8_t* convert_tiles(png_structp png_ptr, png_infop info_ptr, png_bytepp row_pointers, unsigned int bitplane_count, unsigned int tilesize, struct tilemap* map, unsigned int* data_size);
 void output_tiles_binary(char* basename, uint8_t* data, int bytes);
 void output_tiles_wla(char* basename, uint8_t* data, int bytes);
 
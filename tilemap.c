@@ -0,0 +1,87 @@
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tile.h"
+#include "tilemap.h"
+
+void tilemap_init(struct tilemap* map, unsigned int width, unsigned int height, unsigned int base_tile, int priority)
+{
+  map->width = width;
+  map->height = height;
+  map->base_tile = base_tile;
+  map->priority = priority;
+
+  //Cells outside of the image point to character 0
+  map->entries = calloc(width * height, sizeof(uint16_t));
+}
+
+void tilemap_free(struct tilemap* map)
+{
+  free(map->entries);
+  map->entries = NULL;
+}
+
+//Find the smallest screen layout holding the given number of cells
+void tilemap_fit(unsigned int columns, unsigned int rows, unsigned int* width, unsigned int* height)
+{
+  *width = columns > TILEMAP_SCREEN_SIZE ? TILEMAP_SCREEN_SIZE * 2 : TILEMAP_SCREEN_SIZE;
+  *height = rows > TILEMAP_SCREEN_SIZE ? TILEMAP_SCREEN_SIZE * 2 : TILEMAP_SCREEN_SIZE;
+}
+
+//Larger maps are made of 32x32 screens stored one after the other, left to
+//right then top to bottom
+unsigned int tilemap_index(const struct tilemap* map, unsigned int x, unsigned int y)
+{
+  unsigned int screen = (x / TILEMAP_SCREEN_SIZE) + ((y / TILEMAP_SCREEN_SIZE) * (map->width / TILEMAP_SCREEN_SIZE));
+
+  return (screen * TILEMAP_SCREEN_SIZE * TILEMAP_SCREEN_SIZE) + ((y % TILEMAP_SCREEN_SIZE) * TILEMAP_SCREEN_SIZE) + (x % TILEMAP_SCREEN_SIZE);
+}
+
+void tilemap_set(struct tilemap* map, unsigned int x, unsigned int y, unsigned int tile, unsigned int palette, uint16_t flags)
+{
+  //Cells outside of the map are clipped
+  if(x >= map->width || y >= map->height)
+    return;
+
+  tile += map->base_tile;
+
+  if(map->priority)
+    flags |= TILEMAP_PRIORITY;
+
+  map->entries[tilemap_index(map, x, y)] = flags | ((palette & TILEMAP_PALETTE_MASK) << TILEMAP_PALETTE_SHIFT) | (tile & TILEMAP_TILE_MASK);
+}
+
+void tilemap_set_palette(struct tilemap* map, unsigned int x, unsigned int y, unsigned int palette)
+{
+  uint16_t* entry;
+
+  if(x >= map->width || y >= map->height)
+    return;
+
+  entry = &map->entries[tilemap_index(map, x, y)];
+  *entry = (*entry & ~(TILEMAP_PALETTE_MASK << TILEMAP_PALETTE_SHIFT)) | ((palette & TILEMAP_PALETTE_MASK) << TILEMAP_PALETTE_SHIFT);
+}
+
+unsigned int tilemap_size(const struct tilemap* map)
+{
+  return map->width * map->height;
+}
+
+//Colors above the ones reachable with the bitplanes select the palette
+unsigned int tile_palette(const uint8_t* tile, unsigned int bitplane_count)
+{
+  uint8_t max = 0;
+
+  if(bitplane_count >= 8)
+    return 0;
+
+  for(size_t i = 0; i < TILE_SIZE; i++)
+  {
+    if(tile[i] > max)
+      max = tile[i];
+  }
+
+  return (max >> bitplane_count) & TILEMAP_PALETTE_MASK;
+}
@@ -0,0 +1,34 @@
+#ifndef TILEMAP_H
+#define TILEMAP_H
+#include <stdint.h>
+
+/* BG map of 16-bit entries: vhopppcc cccccccc */
+struct tilemap
+{
+  uint16_t* entries;
+  unsigned int width;
+  unsigned int height;
+  unsigned int base_tile;
+  int priority;
+};
+
+void tilemap_init(struct tilemap* map, unsigned int width, unsigned int height, unsigned int base_tile, int priority);
+void tilemap_free(struct tilemap* map);
+void tilemap_fit(unsigned int columns, unsigned int rows, unsigned int* width, unsigned int* height);
+unsigned int tilemap_index(const struct tilemap* map, unsigned int x, unsigned int y);
+void tilemap_set(struct tilemap* map, unsigned int x, unsigned int y, unsigned int tile, unsigned int palette, uint16_t flags);
+void tilemap_set_palette(struct tilemap* map, unsigned int x, unsigned int y, unsigned int palette);
+unsigned int tilemap_size(const struct tilemap* map);
+unsigned int tile_palette(const uint8_t* tile, unsigned int bitplane_count);
+
+#define TILEMAP_SCREEN_SIZE 32
+#define TILEMAP_MAX_TILES 1024
+
+#define TILEMAP_TILE_MASK 0x03FF
+#define TILEMAP_PALETTE_SHIFT 10
+#define TILEMAP_PALETTE_MASK 0x07
+#define TILEMAP_PRIORITY 0x2000
+#define TILEMAP_HFLIP 0x4000
+#define TILEMAP_VFLIP 0x8000
+
+#endif //TILEMAP_H
@@ -0,0 +1,106 @@
+#include <png.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tile.h"
+#include "tileset.h"
+
+#define INITIAL_CAPACITY 256
+
+void tileset_init(struct tileset* set)
+{
+  set->count = 0;
+  set->capacity = INITIAL_CAPACITY;
+  set->tiles = malloc(set->capacity * TILE_SIZE);
+  set->hashes = malloc(set->capacity * sizeof(uint32_t));
+
+  //Keep the table at most half full
+  set->bucket_count = INITIAL_CAPACITY * 2;
+  set->buckets = calloc(set->bucket_count, sizeof(uint32_t));
+}
+
+void tileset_free(struct tileset* set)
+{
+  free(set->tiles);
+  free(set->hashes);
+  free(set->buckets);
+  set->tiles = NULL;
+  set->hashes = NULL;
+  set->buckets = NULL;
+  set->count = set->capacity = set->bucket_count = 0;
+}
+
+uint32_t hash_tile(const uint8_t* tile)
+{
+  uint64_t hash = 0, word;
+
+  //Hash the tile eight pixels at a time
+  for(size_t i = 0; i < TILE_SIZE; i += 8)
+  {
+    memcpy(&word, tile + i, 8);
+    hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+    hash ^= hash >> 29;
+  }
+
+  return (uint32_t)(hash ^ (hash >> 32));
+}
+
+int tileset_find(const struct tileset* set, const uint8_t* tile, uint32_t hash)
+{
+  unsigned int mask = set->bucket_count - 1;
+
+  for(unsigned int bucket = hash & mask; set->buckets[bucket] != 0; bucket = (bucket + 1) & mask)
+  {
+    unsigned int index = set->buckets[bucket] - 1;
+
+    if(set->hashes[index] == hash && memcmp(set->tiles + (index * TILE_SIZE), tile, TILE_SIZE) == 0)
+      return index;
+  }
+
+  return -1;
+}
+
+void tileset_insert_bucket(struct tileset* set, unsigned int index)
+{
+  unsigned int mask = set->bucket_count - 1;
+  unsigned int bucket = set->hashes[index] & mask;
+
+  while(set->buckets[bucket] != 0)
+    bucket = (bucket + 1) & mask;
+
+  set->buckets[bucket] = index + 1;
+}
+
+void tileset_grow(struct tileset* set)
+{
+  set->capacity *= 2;
+  set->tiles = realloc(set->tiles, set->capacity * TILE_SIZE);
+  set->hashes = realloc(set->hashes, set->capacity * sizeof(uint32_t));
+
+  //Rebuild the table from the stored hashes
+  free(set->buckets);
+  set->bucket_count = set->capacity * 2;
+  set->buckets = calloc(set->bucket_count, sizeof(uint32_t));
+
+  for(unsigned int i = 0; i < set->count; i++)
+    tileset_insert_bucket(set, i);
+}
+
+unsigned int tileset_add(struct tileset* set, const uint8_t* tile)
+{
+  uint32_t hash = hash_tile(tile);
+  int index = tileset_find(set, tile, hash);
+
+  if(index >= 0)
+    return index;
+
+  if(set->count == set->capacity)
+    tileset_grow(set);
+
+  memcpy(set->tiles + (set->count * TILE_SIZE), tile, TILE_SIZE);
+  set->hashes[set->count] = hash;
+  tileset_insert_bucket(set, set->count);
+
+  return set->count++;
+}
@@ -0,0 +1,30 @@
+#ifndef TILESET_H
+#define TILESET_H
+#include <stdint.h>
+
+/* Set of unique 8x8 chunky tiles (one byte per pixel), indexed by a hash
+   table so that adding a tile is O(1) whatever the number of tiles. */
+struct tileset
+{
+  uint8_t* tiles;
+  uint32_t* hashes;
+  unsigned int count;
+  unsigned int capacity;
+
+  /* Open addressing table holding tile index + 1, 0 marks an empty bucket */
+  uint32_t* buckets;
+  unsigned int bucket_count;
+};
+
+void tileset_init(struct tileset* set);
+void tileset_free(struct tileset* set);
+uint32_t hash_tile(const uint8_t* tile);
+int tileset_find(const struct tileset* set, const uint8_t* tile, uint32_t hash);
+unsigned int tileset_add(struct tileset* set, const uint8_t* tile);
+
+/* Tiles differing only by their sub-palette are stored once */
+#define DEDUP_PALETTE 0x01
+/* Flipped tiles are stored once, the BG map entry flips them back */
+#define DEDUP_FLIP 0x02
+
+#endif //TILESET_H
@@ -0,0 +1,86 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+FILE* trace_output = NULL;
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int trace_event_count = 0;
+
+int trace_open(const char* filename)
+{
+  trace_output = fopen(filename, "w");
+
+  if(!trace_output)
+  {
+    perror(filename);
+    return -1;
+  }
+
+  fprintf(trace_output, "{\"traceEvents\":[");
+  return 0;
+}
+
+void trace_close()
+{
+  if(!trace_output)
+    return;
+
+  fprintf(trace_output, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  fclose(trace_output);
+  trace_output = NULL;
+}
+
+//Microseconds on a monotonic clock
+uint64_t trace_now()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+void write_json_string(FILE* fp, const char* string)
+{
+  putc('"', fp);
+
+  for(const char* p = string; *p; p++)
+  {
+    if(*p == '"' || *p == '\\')
+      fprintf(fp, "\\%c", *p);
+    else if((unsigned char)*p < 0x20)
+      fprintf(fp, "\\u%04x", *p);
+    else
+      putc(*p, fp);
+  }
+
+  putc('"', fp);
+}
+
+//Write a complete event from start to now, on the calling thread
+void trace_event(const char* name, const char* file, uint64_t start)
+{
+  uint64_t end = trace_now();
+  long thread = syscall(SYS_gettid);
+
+  pthread_mutex_lock(&trace_mutex);
+
+  fprintf(trace_output, "%s\n{\"name\":\"%s\",\"cat\":\"png2snes\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%ld,\"tid\":%ld",
+    trace_event_count++ ? "," : "", name, (unsigned long long)start, (unsigned long long)(end - start), (long)getpid(), thread);
+
+  if(file)
+  {
+    fprintf(trace_output, ",\"args\":{\"file\":");
+    write_json_string(trace_output, file);
+    putc('}', trace_output);
+  }
+
+  putc('}', trace_output);
+
+  pthread_mutex_unlock(&trace_mutex);
+}
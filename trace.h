@@ -0,0 +1,26 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stdint.h>
+#include <stdio.h>
+
+/* Chrome trace event output, NULL when tracing is disabled */
+extern FILE* trace_output;
+
+int trace_open(const char* filename);
+void trace_close();
+uint64_t trace_now();
+void trace_event(const char* name, const char* file, uint64_t start);
+
+/* Only a pointer comparison when tracing is disabled */
+#define TRACE_BEGIN() (trace_output ? trace_now() : 0)
+#define TRACE_END(name, file, start) do { if(trace_output) trace_event(name, file, start); } while(0)
+
+/* Static probe points, for perf, bpftrace or SystemTap */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define TRACE_PROBE(name, arg1, arg2) DTRACE_PROBE2(png2snes, name, arg1, arg2)
+#else
+#define TRACE_PROBE(name, arg1, arg2) do { } while(0)
+#endif
+
+#endif //TRACE_H